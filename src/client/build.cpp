@@ -97,7 +97,7 @@ String get_config()
     // but return hashed
 
     auto &db = getServiceDatabase();
-    auto h = Settings::get_local_settings().get_hash();
+    auto h = Settings::get_local_settings().get_toolchain_hash();
     auto c = db.getConfigByHash(h);
 
     if (!c.empty())
@@ -151,7 +151,7 @@ int build_packages(const Config &c, const String &name)
             new_config = true;
 
             // also register in db
-            auto h = Settings::get_local_settings().get_hash();
+            auto h = Settings::get_local_settings().get_toolchain_hash();
             sdb.addConfigHash(h, config, ch);
 
             // do we need to addConfigHash() here? like in get_config()
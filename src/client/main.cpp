@@ -21,6 +21,7 @@
 
 #include <access_table.h>
 #include <api.h>
+#include <archive_cache.h>
 #include <config.h>
 #include <database.h>
 #include <exceptions.h>
@@ -276,6 +277,12 @@ try
         c.clear_vars_cache();
         return 0;
     }
+    if (options["cache-gc"].as<bool>())
+    {
+        auto &us = Settings::get_user_settings();
+        getArchiveCache().gc(uintmax_t(us.archive_cache_size) * 1024 * 1024);
+        return 0;
+    }
     if (options().count(CLEAN_PACKAGES))
     {
         auto fs = CleanTarget::getStrings();
@@ -622,7 +629,7 @@ std::optional<int> internal(const Strings &args)
         if (args.size() < 6)
         {
             std::cout << "invalid number of arguments: " << args.size() << "\n";
-            std::cout << "usage: cppan internal-parallel-vars-check vars_dir vars_file checks_file generator toolset toolchain\n";
+            std::cout << "usage: cppan internal-parallel-vars-check vars_dir vars_file checks_file generator toolset toolchain settings_hash\n";
             return 1;
         }
 
@@ -636,6 +643,7 @@ std::optional<int> internal(const Strings &args)
         ASSIGN_ARG(generator);
         ASSIGN_ARG(toolset);
         ASSIGN_ARG(toolchain);
+        ASSIGN_ARG(settings_hash);
 #undef ASSIGN_ARG
 
         CMakePrinter c;
@@ -51,6 +51,7 @@ ProgramOptions::ProgramOptions()
 
         ("clear-cache", po::bool_switch(), "clear CMakeCache.txt files")
         ("clear-vars-cache", po::bool_switch(), "clear checked symbols, types, includes etc.")
+        ("cache-gc", po::bool_switch(), "remove least recently used archives from download cache")
         (CLEAN_PACKAGES, po::value<Strings>()->multitoken(), "completely clean package files for matched regex")
         (CLEAN_CONFIGS, po::value<Strings>()->multitoken(), "clean config dirs and files")
 
@@ -19,38 +19,125 @@
 #include "cppan_string.h"
 #include "database.h"
 #include "directories.h"
+#include "hash.h"
 #include "lock.h"
 #include "stamp.h"
 
-#include <unordered_map>
+#include <mutex>
+#include <unordered_set>
 
-struct AccessData
+// stamps are split into shards by path hash,
+// so parallel printers rarely wait for each other
+const size_t n_shards = 16;
+
+struct AccessShard
 {
     Stamps stamps;
+    std::unordered_set<path> dirty;
+    std::unordered_set<path> removed;
+    shared_mutex m;
+};
+
+struct AccessData
+{
+    AccessShard shards[n_shards];
     bool do_not_update = false;
     int refs = 0;
+    std::mutex m;
+
+    AccessShard &shard(const path &p)
+    {
+        return shards[std::hash<path>()(p) % n_shards];
+    }
 
     void load()
     {
+        std::lock_guard<std::mutex> lock(m);
         if (refs++ > 0)
             return;
 
-        stamps = getServiceDatabase().getFileStamps();
+        for (auto &s : getServiceDatabase().getFileStamps())
+            shard(s.first).stamps.insert(s);
     }
 
     void save()
     {
+        std::lock_guard<std::mutex> lock(m);
         if (--refs > 0)
             return;
 
-        getServiceDatabase().setFileStamps(stamps);
+        Stamps changed;
+        std::vector<path> removed;
+        for (auto &sh : shards)
+        {
+            std::lock_guard<shared_mutex> lock(sh.m);
+            for (auto &p : sh.dirty)
+            {
+                auto i = sh.stamps.find(p);
+                if (i != sh.stamps.end())
+                    changed.insert(*i);
+            }
+            removed.insert(removed.end(), sh.removed.begin(), sh.removed.end());
+            sh.dirty.clear();
+            sh.removed.clear();
+        }
+        getServiceDatabase().updateFileStamps(changed, removed);
+    }
+
+    FileStamp get(const path &p)
+    {
+        auto &sh = shard(p);
+        std::shared_lock<shared_mutex> lock(sh.m);
+        auto i = sh.stamps.find(p);
+        if (i == sh.stamps.end())
+            return {};
+        return i->second;
+    }
+
+    void set(const path &p, time_t t, const String &h)
+    {
+        auto &sh = shard(p);
+        std::lock_guard<shared_mutex> lock(sh.m);
+        auto &v = sh.stamps[p];
+        if (v.time == t && v.hash == h)
+            return;
+        v.time = t;
+        v.hash = h;
+        sh.dirty.insert(p);
+        sh.removed.erase(p);
     }
 
     void clear()
     {
-        stamps.clear();
+        std::lock_guard<std::mutex> lock(m);
+        for (auto &sh : shards)
+        {
+            std::lock_guard<shared_mutex> lock(sh.m);
+            sh.stamps.clear();
+            sh.dirty.clear();
+            sh.removed.clear();
+        }
         getServiceDatabase().clearFileStamps();
     }
+
+    void remove(const path &p)
+    {
+        for (auto &sh : shards)
+        {
+            std::lock_guard<shared_mutex> lock(sh.m);
+            for (auto i = sh.stamps.begin(); i != sh.stamps.end();)
+            {
+                if (is_under_root(i->first, p))
+                {
+                    sh.dirty.erase(i->first);
+                    sh.removed.insert(i->first);
+                    i = sh.stamps.erase(i);
+                }
+                else
+                    ++i;
+            }
+        }
+    }
 };
 
 static AccessData data;
@@ -73,7 +160,7 @@ bool AccessTable::must_update_contents(const path &p) const
         return false;
     if (!is_under_root(p, directories.storage_dir_etc))
         return true;
-    return fs::last_write_time(p) != data.stamps[p];
+    return fs::last_write_time(p) != data.get(p).time;
 }
 
 bool AccessTable::updates_disabled() const
@@ -82,20 +169,37 @@ bool AccessTable::updates_disabled() const
 }
 
 void AccessTable::update_contents(const path &p, const String &s) const
+{
+    update_contents(p, s, sha256(s));
+}
+
+void AccessTable::update_contents(const path &p, const String &s, const String &h) const
 {
     write_file_if_different(p, s);
-    data.stamps[p] = fs::last_write_time(p);
+    data.set(p, fs::last_write_time(p), h);
 }
 
 void AccessTable::write_if_older(const path &p, const String &s) const
 {
-    if (!is_under_root(p, directories.storage_dir_etc))
+    // files outside of storage can be removed by user at any time
+    if (!is_under_root(p, directories.storage_dir))
     {
         write_file_if_different(p, s);
         return;
     }
+
+    // we wrote exactly this text last time and the file is still there
+    auto h = sha256(s);
+    if (data.get(p).hash == h && fs::exists(p))
+        return;
+
+    if (!is_under_root(p, directories.storage_dir_etc))
+    {
+        update_contents(p, s, h);
+        return;
+    }
     if (must_update_contents(p))
-        update_contents(p, s);
+        update_contents(p, s, h);
 }
 
 void AccessTable::clear() const
@@ -105,14 +209,7 @@ void AccessTable::clear() const
 
 void AccessTable::remove(const path &p) const
 {
-    std::set<path> rm;
-    for (auto &s : data.stamps)
-    {
-        if (is_under_root(s.first, p))
-            rm.insert(s.first);
-    }
-    for (auto &s : rm)
-        data.stamps.erase(s);
+    data.remove(p);
 }
 
 void AccessTable::do_not_update_files(bool v)
@@ -19,6 +19,9 @@
 #include "cppan_string.h"
 #include "filesystem.h"
 
+/// File stamps of generated files.
+/// All tables share one stamp store that is safe to use from different threads.
+/// Changed stamps are saved when the last table is destroyed.
 class AccessTable
 {
 public:
@@ -33,4 +36,7 @@ public:
     void remove(const path &p) const;
 
     static void do_not_update_files(bool v);
+
+private:
+    void update_contents(const path &p, const String &s, const String &h) const;
 };
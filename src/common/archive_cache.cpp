@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "archive_cache.h"
+
+#include "hash.h"
+#include "settings.h"
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "archive_cache");
+
+ArchiveCache &getArchiveCache()
+{
+    static ArchiveCache cache(get_root_directory() / "cache" / "archives");
+    return cache;
+}
+
+ArchiveCache::ArchiveCache(const path &dir)
+    : dir(dir)
+{
+}
+
+path ArchiveCache::getArchivePath(const String &hash) const
+{
+    // split to not have too many files in one dir
+    return dir / hash.substr(0, 2) / make_archive_name(hash);
+}
+
+bool ArchiveCache::get(const String &hash, const path &fn) const
+{
+    if (hash.size() < 2)
+        return false;
+
+    auto p = getArchivePath(hash);
+    boost::system::error_code ec;
+    if (!fs::exists(p, ec))
+        return false;
+
+    fs::copy_file(p, fn, fs::copy_option::overwrite_if_exists, ec);
+    if (ec)
+        return false;
+    if (!check_file_hash(fn, hash))
+    {
+        LOG_DEBUG(logger, "Removing bad cached archive: " << p.string());
+        fs::remove(p, ec);
+        fs::remove(fn, ec);
+        return false;
+    }
+
+    // mark as recently used
+    fs::last_write_time(p, time(nullptr), ec);
+    return true;
+}
+
+void ArchiveCache::add(const String &hash, const path &fn) const
+{
+    if (hash.size() < 2)
+        return;
+
+    auto p = getArchivePath(hash);
+    boost::system::error_code ec;
+    if (fs::exists(p, ec))
+        return;
+
+    // copy under unique name and rename, so readers never see partial files
+    fs::create_directories(p.parent_path(), ec);
+    auto tmp = p.parent_path() / fs::unique_path();
+    fs::copy_file(fn, tmp, ec);
+    if (!ec)
+        fs::rename(tmp, p, ec);
+    if (ec)
+    {
+        LOG_DEBUG(logger, "Cannot add archive to cache: " << ec.message());
+        fs::remove(tmp, ec);
+    }
+}
+
+void ArchiveCache::gc(uintmax_t max_size) const
+{
+    if (!fs::exists(dir))
+        return;
+
+    struct Archive
+    {
+        path p;
+        time_t t;
+        uintmax_t size;
+    };
+
+    std::vector<Archive> archives;
+    for (auto &f : boost::make_iterator_range(fs::recursive_directory_iterator(dir), {}))
+    {
+        if (!fs::is_regular_file(f))
+            continue;
+        archives.push_back({ f.path(), fs::last_write_time(f), fs::file_size(f) });
+    }
+
+    std::sort(archives.begin(), archives.end(), [](const auto &a1, const auto &a2)
+    {
+        return a1.t > a2.t;
+    });
+
+    uintmax_t size = 0;
+    size_t n_removed = 0;
+    for (auto &a : archives)
+    {
+        size += a.size;
+        if (size <= max_size)
+            continue;
+        boost::system::error_code ec;
+        fs::remove(a.p, ec);
+        if (!ec)
+            n_removed++;
+    }
+    if (n_removed)
+        LOG_DEBUG(logger, "Removed " << n_removed << " archives from cache");
+}
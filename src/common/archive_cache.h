@@ -0,0 +1,44 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "cppan_string.h"
+#include "filesystem.h"
+
+/// Downloaded package archives stored by their hash.
+/// The cache is shared by all storage dirs, so switching storage
+/// or cleaning package sources does not require network access.
+/// Least recently used archives are removed first on gc.
+class ArchiveCache
+{
+public:
+    ArchiveCache(const path &dir);
+
+    // copies cached archive to fn, returns false on miss or bad archive
+    bool get(const String &hash, const path &fn) const;
+    void add(const String &hash, const path &fn) const;
+
+    // keeps total size of archives under max_size bytes
+    void gc(uintmax_t max_size) const;
+
+private:
+    path dir;
+
+    path getArchivePath(const String &hash) const;
+};
+
+ArchiveCache &getArchiveCache();
@@ -17,13 +17,18 @@
 #include "checks.h"
 #include "checks_detail.h"
 
+#include "database.h"
 #include "hash.h"
 #include "printers/printer.h"
+#include "settings.h"
 
 #include <boost/algorithm/string.hpp>
 
+#include <algorithm>
 #include <memory>
+#include <regex>
 
+#include <primitives/hasher.h>
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "checks");
 
@@ -841,37 +846,156 @@ void Checks::write_definitions(CMakeContext &ctx, const Package &d, const String
     }
 }
 
-void Checks::remove_known_vars(const std::set<String> &known_vars)
+Checks Checks::remove_known_vars(const std::map<String, String> &known_vars, const String &toolchain_hash)
 {
+    std::map<String, int> known_values;
     auto checks_old = checks;
     for (auto &c : checks_old)
     {
-        if (known_vars.find(c->getVariable()) != known_vars.end())
-            checks.erase(c);
+        auto i = known_vars.find(c->getVariable());
+        if (i == known_vars.end())
+            continue;
+        checks.erase(c);
+
+        // remember values evaluated by cmake too
+        if (c->getInformation().type == Check::Decl || i->second.empty() ||
+            !std::all_of(i->second.begin(), i->second.end(), [](auto c) { return isdigit(c); }))
+            continue;
+        known_values[c->getHash()] = std::stoi(i->second);
+    }
+
+    Checks cached;
+    if (toolchain_hash.empty())
+        return cached;
+
+    auto &sdb = getServiceDatabase();
+    sdb.setCheckResults(toolchain_hash, known_values);
+
+    auto results = sdb.getCheckResults(toolchain_hash);
+    if (results.empty())
+        return cached;
+    checks_old = checks;
+    for (auto &c : checks_old)
+    {
+        // decls do not participate in parallel checks
+        if (c->getInformation().type == Check::Decl)
+            continue;
+        auto i = results.find(c->getHash());
+        if (i == results.end())
+            continue;
+        c->setValue(i->second);
+        cached.checks.insert(c);
+        checks.erase(c);
     }
+    return cached;
 }
 
-std::vector<Checks> Checks::scatter(int N) const
+void Checks::save_values(const String &toolchain_hash) const
 {
-    std::vector<Checks> workers(N);
-    int i = 0;
+    std::map<String, int> values;
     for (auto &c : checks)
     {
-        auto &inf = c->getInformation();
-        auto t = inf.type;
+        if (c->getInformation().type == Check::Decl)
+            continue;
+        values[c->getHash()] = c->getValue();
+    }
+    getServiceDatabase().setCheckResults(toolchain_hash, values);
+}
 
-        switch (t)
-        {
-        case Check::Decl: // do not participate in parallel
-            break;
-        default:
-            workers[i++ % N].checks.insert(c);
-            break;
-        }
+std::vector<Checks> Checks::scatter(int N, const CheckDurations &durations) const
+{
+    std::vector<std::pair<int64_t, CheckPtr>> costs;
+    for (auto &c : checks)
+    {
+        // decls do not participate in parallel
+        if (c->getInformation().type == Check::Decl)
+            continue;
+        costs.emplace_back(durations.get(*c), c);
+    }
+    std::stable_sort(costs.begin(), costs.end(), [](const auto &a, const auto &b)
+    {
+        return a.first > b.first;
+    });
+
+    std::vector<Checks> workers(N);
+    std::vector<int64_t> load(N);
+    for (auto &c : costs)
+    {
+        auto i = std::min_element(load.begin(), load.end()) - load.begin();
+        load[i] += c.first;
+        workers[i].checks.insert(c.second);
+    }
+
+    auto critical_path = *std::max_element(load.begin(), load.end());
+    if (critical_path)
+    {
+        String u;
+        for (auto &l : load)
+            u += " " + std::to_string(l * 100 / critical_path) + "%";
+        LOG_DEBUG(logger, "-- Estimated critical path: " << critical_path << " ms, worker utilization:" << u);
     }
     return workers;
 }
 
+void CheckDurations::load()
+{
+    std::map<int, std::pair<int64_t, int64_t>> sums;
+    for (auto &d : getServiceDatabase().getCheckDurations())
+    {
+        checks[d.first] = d.second.second;
+        auto &s = sums[d.second.first];
+        s.first += d.second.second;
+        s.second++;
+    }
+    for (auto &s : sums)
+        types[s.first] = s.second.first / s.second.second;
+}
+
+void CheckDurations::save() const
+{
+    getServiceDatabase().setCheckDurations(measured);
+}
+
+int64_t CheckDurations::get(const Check &c) const
+{
+    auto i = checks.find(c.getHash());
+    if (i != checks.end())
+        return i->second;
+
+    auto t = c.getInformation().type;
+    auto j = types.find(t);
+    if (j != types.end())
+        return j->second;
+
+    // rough relative costs when nothing was recorded yet
+    switch (t)
+    {
+    case Check::Library:
+        return 50;
+    case Check::Include:
+    case Check::Type:
+    case Check::Alignment:
+    case Check::StructMember:
+        return 100;
+    case Check::Function:
+    case Check::LibraryFunction:
+    case Check::Symbol:
+    case Check::CSourceCompiles:
+    case Check::CXXSourceCompiles:
+        return 200; // link step
+    case Check::CSourceRuns:
+    case Check::CXXSourceRuns:
+        return 300;
+    default:
+        return 400;
+    }
+}
+
+void CheckDurations::set(const Check &c, int64_t ms)
+{
+    measured[c.getHash()] = { c.getInformation().type, ms };
+}
+
 void Checks::print_values() const
 {
     std::map<String, CheckPtr> checks_to_print;
@@ -966,6 +1090,43 @@ String Check::make_struct_member_var(const String &m, const String &s)
     return make_include_var(s + " " + m);
 }
 
+String Check::getHash() const
+{
+    Hasher h;
+    h |= (int64_t)information.type;
+    h |= data;
+    h |= cpp;
+    switch (information.type)
+    {
+    case Check::StructMember:
+        h |= ((const CheckStructMember *)this)->struct_;
+        break;
+    case Check::LibraryFunction:
+        h |= ((const CheckLibraryFunction *)this)->library;
+        break;
+    case Check::Custom:
+        // custom code sets the variable by its name
+        h |= variable;
+        //[[fallthrough]];
+    case Check::CSourceCompiles:
+    case Check::CSourceRuns:
+    case Check::CXXSourceCompiles:
+    case Check::CXXSourceRuns:
+        h |= ((const CheckSource *)this)->invert;
+        break;
+    }
+    // full parameters, not the short hash used for file names
+    for (auto &v : parameters.headers)
+        h |= v;
+#define ADD_PARAMS(x) for (auto &v : parameters.x) h |= #x + v
+    ADD_PARAMS(definitions);
+    ADD_PARAMS(include_directories);
+    ADD_PARAMS(libraries);
+    ADD_PARAMS(flags);
+#undef ADD_PARAMS
+    return h.hash;
+}
+
 String Check::getFileName() const
 {
     if (parameters.empty())
@@ -1090,3 +1251,36 @@ bool CheckParameters::operator<(const CheckParameters &p) const
         std::tie(headers, definitions, include_directories, libraries, flags) <
         std::tie(p.headers, p.definitions, p.include_directories, p.libraries, p.flags);
 }
+
+String ParallelCheckOptions::getToolchainHash() const
+{
+    static const std::regex r_compiler("set\\(CMAKE_\\w+_COMPILER \"([^\"]*)\"\\)");
+
+    Hasher h;
+    h |= generator;
+    h |= toolset;
+    h |= toolchain;
+    h |= settings_hash;
+
+    // compilers detected by the test run
+    auto cmake_files = dir / "CMakeFiles";
+    if (!fs::exists(cmake_files))
+        return h.hash;
+    for (auto &d : boost::make_iterator_range(fs::directory_iterator(cmake_files), {}))
+    {
+        if (!fs::is_directory(d))
+            continue;
+        for (auto &f : { "CMakeSystem.cmake", "CMakeCCompiler.cmake", "CMakeCXXCompiler.cmake" })
+        {
+            auto fn = d.path() / f;
+            if (!fs::exists(fn))
+                continue;
+            auto s = read_file(fn);
+            h |= s;
+            std::smatch m;
+            if (std::regex_search(s, m, r_compiler))
+                h |= get_compiler_fingerprint(m[1].str());
+        }
+    }
+    return h.hash;
+}
@@ -106,6 +106,8 @@ public:
     virtual void set_cpp(bool) {}
 
     String getFileName() const;
+    // identifies the probe, does not depend on the variable name
+    String getHash() const;
 
     virtual String printStatus() const
     {
@@ -174,6 +176,23 @@ struct CheckPtrLess
 
 using ChecksSet = std::set<CheckPtr, CheckPtrLess<CheckPtr>>;
 
+/// Durations of checks from previous runs, used for scheduling.
+struct CheckDurations
+{
+    void load();
+    // writes measured durations
+    void save() const;
+
+    // ms, estimated by check type when check was never run
+    int64_t get(const Check &c) const;
+    void set(const Check &c, int64_t ms);
+
+private:
+    std::map<String, int64_t> checks;
+    std::map<int, int64_t> types;
+    std::map<String, std::pair<int, int64_t>> measured;
+};
+
 struct Checks
 {
     ChecksSet checks;
@@ -191,8 +210,13 @@ struct Checks
     void write_parallel_checks_for_workers(CMakeContext &ctx) const;
     void read_parallel_checks_for_workers(const path &dir);
 
-    void remove_known_vars(const std::set<String> &known_vars);
-    std::vector<Checks> scatter(int N) const;
+    // removes checks with values already known from the vars file or from
+    // the global results cache, the latter are returned with values set
+    Checks remove_known_vars(const std::map<String, String> &known_vars, const String &toolchain_hash = String());
+    // stores values in the global results cache
+    void save_values(const String &toolchain_hash) const;
+    // longest checks go first, each one to the least loaded worker
+    std::vector<Checks> scatter(int N, const CheckDurations &durations) const;
     void print_values() const;
     void print_values(CMakeContext &ctx) const;
 
@@ -212,4 +236,10 @@ struct ParallelCheckOptions
     String generator;
     String toolset;
     String toolchain;
+    // flags are not visible in the test run files
+    String settings_hash;
+
+    // identifies the compiler and settings checks are evaluated with,
+    // check results are cached under this key
+    String getToolchainHash() const;
 };
@@ -0,0 +1,745 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "checks_native.h"
+#include "checks_detail.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <primitives/command.h>
+#include <primitives/date_time.h>
+#include <primitives/executor.h>
+
+#include <algorithm>
+#include <mutex>
+#include <regex>
+
+#include <primitives/log.h>
+DECLARE_STATIC_LOGGER(logger, "checks.native");
+
+// same preamble as check_type_size() uses
+static const String type_headers = R"(
+#if defined(__has_include)
+# if __has_include(<sys/types.h>)
+#  include <sys/types.h>
+# endif
+# if __has_include(<stdint.h>)
+#  include <stdint.h>
+# endif
+# if __has_include(<stddef.h>)
+#  include <stddef.h>
+# endif
+#endif
+)";
+
+// value is encoded as 'INFO:value0[00042]' into the object file
+// the same way cmake does for check_type_size()
+static String info_key(size_t i)
+{
+    return "INFO:value" + std::to_string(i) + "[";
+}
+
+static String info_value(const String &expr, size_t i)
+{
+    auto n = std::to_string(i);
+    String s;
+    s += "#define CPPAN_INFO_VALUE" + n + " (" + expr + ")\n";
+    s += "char cppan_info" + n + "[] = {";
+    for (auto &c : info_key(i))
+        s += String("'") + c + "', ";
+    s += "\n";
+    for (int d = 10000; d; d /= 10)
+        s += "    ('0' + ((CPPAN_INFO_VALUE" + n + " / " + std::to_string(d) + ") % 10)),\n";
+    s += "    ']', '\\0'};\n";
+    return s;
+}
+
+static String info_main(size_t n)
+{
+    String s;
+    s += "\nint main(int argc, char *argv[])\n{\n";
+    s += "    int require = 0;\n";
+    for (size_t i = 0; i < n; i++)
+        s += "    require += cppan_info" + std::to_string(i) + "[argc];\n";
+    s += "    (void)argv;\n";
+    s += "    return require;\n}\n";
+    return s;
+}
+
+static bool read_info(const String &obj, size_t i, Check::Value &value)
+{
+    auto key = info_key(i);
+    auto p = obj.find(key);
+    if (p == obj.npos)
+        return false;
+    p += key.size();
+    auto e = obj.find(']', p);
+    if (e == obj.npos)
+        return false;
+    auto v = obj.substr(p, e - p);
+    if (v.empty() || !std::all_of(v.begin(), v.end(), [](auto c) { return isdigit(c); }))
+        return false;
+    value = std::stoi(v);
+    return true;
+}
+
+static String info_source(const Check &c, size_t i)
+{
+    if (c.getInformation().type == Check::Alignment)
+    {
+        auto n = std::to_string(i);
+        return "struct cppan_align" + n + " { char a; " + c.getData() + " b; };\n" +
+            info_value("offsetof(struct cppan_align" + n + ", b)", i);
+    }
+    return info_value("sizeof(" + c.getData() + ")", i);
+}
+
+static String include_headers(const Strings &headers)
+{
+    String s;
+    for (auto &h : headers)
+        s += "#include <" + h + ">\n";
+    return s;
+}
+
+NativeChecker::NativeChecker(const ParallelCheckOptions &o)
+    : dir(o.dir / "native")
+{
+    // toolchain may bring its own flags (sysroot etc.), so let cmake handle it
+    if (!o.toolchain.empty())
+        return;
+
+    static const std::regex r_set("set\\((CMAKE_\\w+) \"([^\"]*)\"\\)");
+
+    auto cmake_files = o.dir / "CMakeFiles";
+    if (!fs::exists(cmake_files))
+        return;
+
+    auto load = [](const path &fn, const String &lang, Compiler &c)
+    {
+        if (!fs::exists(fn))
+            return false;
+        for (auto &l : read_lines(fn))
+        {
+            std::smatch m;
+            if (!std::regex_search(l, m, r_set))
+                continue;
+            auto k = m[1].str();
+            if (k == "CMAKE_" + lang + "_COMPILER")
+                c.program = m[2].str();
+            else if (k == "CMAKE_" + lang + "_COMPILER_ID")
+                c.id = m[2].str();
+            else if (k == "CMAKE_" + lang + "_SIMULATE_ID")
+                c.simulate_id = m[2].str();
+            else if (k == "CMAKE_" + lang + "_COMPILER_ARG1" && !m[2].str().empty())
+                boost::split(c.args, m[2].str(), boost::is_any_of(" "), boost::token_compress_on);
+        }
+        return !c.program.empty();
+    };
+
+    for (auto &d : boost::make_iterator_range(fs::directory_iterator(cmake_files), {}))
+    {
+        if (!fs::is_directory(d))
+            continue;
+        if (!load(d.path() / "CMakeCCompiler.cmake", "C", c) ||
+            !load(d.path() / "CMakeCXXCompiler.cmake", "CXX", cxx))
+            continue;
+        auto sys = d.path() / "CMakeSystem.cmake";
+        if (fs::exists(sys))
+            crosscompiling = read_file(sys).find("set(CMAKE_CROSSCOMPILING \"TRUE\")") != String::npos;
+        break;
+    }
+
+    // we speak gcc-like command line only
+    // (clang-cl has Clang id but takes msvc options)
+    auto is_supported = [](const Compiler &c)
+    {
+        if (c.simulate_id == "MSVC")
+            return false;
+        return
+            c.id == "GNU" ||
+            c.id == "Clang" ||
+            c.id == "AppleClang";
+    };
+    available = is_supported(c) && is_supported(cxx);
+    if (available)
+        LOG_DEBUG(logger, "-- Native checks: C compiler " << c.program.string() << ", C++ compiler " << cxx.program.string());
+}
+
+bool NativeChecker::canCheck(const Check &c) const
+{
+    switch (c.getInformation().type)
+    {
+    case Check::Include:
+    case Check::Function:
+    case Check::Type:
+    case Check::Alignment:
+    case Check::LibraryFunction:
+    case Check::Symbol:
+    case Check::StructMember:
+    case Check::CSourceCompiles:
+    case Check::CXXSourceCompiles:
+        return true;
+    case Check::CSourceRuns:
+    case Check::CXXSourceRuns:
+        return !crosscompiling;
+    default:
+        // library lookups, decls and custom cmake code
+        return false;
+    }
+}
+
+String NativeChecker::getPreamble(const Check &c)
+{
+    switch (c.getInformation().type)
+    {
+    case Check::Type:
+    case Check::Alignment:
+        return type_headers + include_headers(c.parameters.headers) + "\n";
+    case Check::Symbol:
+    case Check::StructMember:
+        return include_headers(c.parameters.headers);
+    default:
+        return String();
+    }
+}
+
+String NativeChecker::getPchKey(const Check &c, const String &preamble) const
+{
+    auto cpp = c.get_cpp();
+    return String(cpp ? "c++" : "c") + "\n" +
+        boost::algorithm::join(getArgs(cpp ? cxx : this->c, c.parameters), " ") + "\n" +
+        preamble;
+}
+
+void NativeChecker::precompile(const Check &check, const String &preamble, path &pch)
+{
+    auto d = dir / "pch" / std::to_string(n_probes++);
+    fs::create_directories(d);
+
+    auto h = d / "cppan_pch.h";
+    write_file(h, preamble);
+
+    // gcc looks for .gch and clang for .pch next to the included header
+    auto &compiler = check.get_cpp() ? cxx : c;
+    auto out = h;
+    out += compiler.id == "GNU" ? ".gch" : ".pch";
+
+    primitives::Command cmd;
+    cmd.program = compiler.program;
+    cmd.args = getArgs(compiler, check.parameters);
+    cmd.args.push_back("-x");
+    cmd.args.push_back(check.get_cpp() ? "c++-header" : "c-header");
+    cmd.args.push_back(h.string());
+    cmd.args.push_back("-o");
+    cmd.args.push_back(out.string());
+
+    std::error_code ec;
+    cmd.execute(ec);
+    if (ec)
+    {
+        // headers will be included directly
+        LOG_TRACE(logger, "-- Cannot precompile headers\n" << cmd.err.text);
+        return;
+    }
+    pch = h;
+}
+
+NativeChecker::Probe NativeChecker::getProbe(const Check &c) const
+{
+    Probe p;
+    p.cpp = c.get_cpp();
+
+    switch (c.getInformation().type)
+    {
+    case Check::Include:
+        p.source = "#include <" + c.getData() + ">\n\nint main(void)\n{\n    return 0;\n}\n";
+        break;
+    case Check::Function:
+    case Check::LibraryFunction:
+        p.type = Probe::Link;
+        p.source = R"(
+#ifdef __cplusplus
+extern "C"
+#endif
+char )" + c.getData() + R"((void);
+
+int main(void)
+{
+    )" + c.getData() + R"(();
+    return 0;
+}
+)";
+        break;
+    case Check::Type:
+    case Check::Alignment:
+        p.type = Probe::Info;
+        p.preamble = getPreamble(c);
+        p.source = info_source(c, 0) + info_main(1);
+        break;
+    case Check::Symbol:
+        p.type = Probe::Link;
+        p.preamble = getPreamble(c);
+        p.source = R"(
+int main(int argc, char *argv[])
+{
+    (void)argv;
+#ifndef )" + c.getData() + R"(
+    return ((int *)(&)" + c.getData() + R"())[argc];
+#else
+    (void)argc;
+    return 0;
+#endif
+}
+)";
+        break;
+    case Check::StructMember:
+    {
+        auto s = (const CheckStructMember *)&c;
+        p.preamble = getPreamble(c);
+        p.source = R"(
+int main()
+{
+    (void)sizeof(((()" + s->struct_ + R"( *)0)->)" + c.getData() + R"();
+    return 0;
+}
+)";
+    }
+        break;
+    case Check::CXXSourceCompiles:
+        p.cpp = true;
+        //[[fallthrough]];
+    case Check::CSourceCompiles:
+        p.type = Probe::Link;
+        p.source = c.getData();
+        break;
+    case Check::CXXSourceRuns:
+        p.cpp = true;
+        //[[fallthrough]];
+    case Check::CSourceRuns:
+        p.type = Probe::Run;
+        p.source = c.getData();
+        break;
+    default:
+        throw std::logic_error("Native check for type " + std::to_string(c.getInformation().type) + " not implemented");
+    }
+    return p;
+}
+
+Strings NativeChecker::getArgs(const Compiler &c, const CheckParameters &p) const
+{
+    Strings args = c.args;
+    for (auto &d : p.definitions)
+        args.push_back(d);
+    for (auto &i : p.include_directories)
+        args.push_back("-I" + i);
+    for (auto &f : p.flags)
+    {
+        Strings v;
+        boost::split(v, f, boost::is_any_of(" "), boost::token_compress_on);
+        for (auto &a : v)
+        {
+            if (!a.empty())
+                args.push_back(a);
+        }
+    }
+    return args;
+}
+
+bool NativeChecker::build(const Check &check, const Probe &p, path &out)
+{
+    auto d = dir / std::to_string(n_probes++);
+    fs::create_directories(d);
+
+    auto &compiler = p.cpp ? cxx : c;
+
+    // shared headers are taken from the precompiled header when there is one
+    path pch;
+    if (!p.preamble.empty())
+    {
+        auto i = pchs.find(getPchKey(check, p.preamble));
+        if (i != pchs.end())
+            pch = i->second;
+    }
+
+    auto src = d / (p.cpp ? "src.cpp" : "src.c");
+    write_file(src, pch.empty() ? p.preamble + p.source : p.source);
+    out = d / "src.o";
+    if (p.type != Probe::Compile && p.type != Probe::Info)
+    {
+        out = d / "src";
+#ifdef _WIN32
+        out += ".exe";
+#endif
+    }
+
+    primitives::Command cmd;
+    cmd.program = compiler.program;
+    cmd.args = getArgs(compiler, check.parameters);
+    if (!pch.empty())
+    {
+        cmd.args.push_back("-include");
+        cmd.args.push_back(pch.string());
+    }
+    if (p.type == Probe::Compile || p.type == Probe::Info)
+        cmd.args.push_back("-c");
+    cmd.args.push_back(src.string());
+    cmd.args.push_back("-o");
+    cmd.args.push_back(out.string());
+    if (p.type == Probe::Link || p.type == Probe::Run)
+    {
+        auto add_library = [&cmd](const String &l)
+        {
+            if (l.empty())
+                return;
+            if (l[0] == '-' || fs::exists(l))
+                cmd.args.push_back(l);
+            else
+                cmd.args.push_back("-l" + l);
+        };
+        for (auto &l : check.parameters.libraries)
+            add_library(l);
+        if (check.getInformation().type == Check::LibraryFunction)
+            add_library(((const CheckLibraryFunction *)&check)->library);
+    }
+
+    std::error_code ec;
+    cmd.execute(ec);
+    if (ec)
+    {
+        LOG_TRACE(logger, "-- " << check.getVariable() << ": compiler failed\n" << cmd.err.text);
+        return false;
+    }
+    return true;
+}
+
+bool NativeChecker::compile(const Check &check, bool cpp, const Strings &sources)
+{
+    auto d = dir / std::to_string(n_probes++);
+    fs::create_directories(d);
+
+    auto &compiler = cpp ? cxx : c;
+
+    primitives::Command cmd;
+    cmd.program = compiler.program;
+    cmd.args = getArgs(compiler, check.parameters);
+    cmd.args.push_back("-fsyntax-only");
+    for (size_t i = 0; i < sources.size(); i++)
+    {
+        auto src = d / ("src" + std::to_string(i) + (cpp ? ".cpp" : ".c"));
+        write_file(src, sources[i]);
+        cmd.args.push_back(src.string());
+    }
+
+    std::error_code ec;
+    cmd.execute(ec);
+    if (ec)
+    {
+        LOG_TRACE(logger, "-- " << check.getVariable() << ": compiler failed\n" << cmd.err.text);
+        return false;
+    }
+    return true;
+}
+
+bool NativeChecker::execute(const Check &check, Check::Value &value)
+{
+    auto p = getProbe(check);
+    path out;
+    if (!build(check, p, out))
+        return false;
+
+    switch (p.type)
+    {
+    case Probe::Info:
+        return read_info(read_file(out, true), 0, value);
+    case Probe::Run:
+    {
+        primitives::Command run;
+        run.program = out;
+        run.working_directory = out.parent_path();
+        std::error_code ec;
+        run.execute(ec);
+        value = !ec;
+        return true;
+    }
+    default:
+        value = 1;
+        return true;
+    }
+}
+
+void NativeChecker::execute(const std::vector<CheckPtr> &batch)
+{
+    if (batch.empty())
+        return;
+
+    auto set_value = [](const CheckPtr &c, Check::Value v)
+    {
+        if (c->getInformation().type == Check::CSourceCompiles ||
+            c->getInformation().type == Check::CXXSourceCompiles ||
+            c->getInformation().type == Check::CSourceRuns ||
+            c->getInformation().type == Check::CXXSourceRuns)
+        {
+            if (((const CheckSource *)c.get())->invert)
+                v = !v;
+        }
+        c->setValue(v);
+    };
+
+    auto &first = *batch[0];
+    if (batch.size() == 1)
+    {
+        Check::Value v = 0;
+        if (!execute(first, v))
+            v = 0;
+        set_value(batch[0], v);
+        return;
+    }
+
+    // all checks in a batch have the same type, language and parameters
+    Probe p;
+    p.cpp = first.get_cpp();
+
+    auto bisect = [this, &batch]
+    {
+        auto middle = batch.begin() + batch.size() / 2;
+        execute(std::vector<CheckPtr>(batch.begin(), middle));
+        execute(std::vector<CheckPtr>(middle, batch.end()));
+    };
+
+    switch (first.getInformation().type)
+    {
+    case Check::Include:
+    {
+        // missing headers are filtered out cheaply with __has_include,
+        // the rest must also compile, each one on its own
+        auto &headers = batch;
+        p.type = Probe::Info;
+        for (size_t i = 0; i < headers.size(); i++)
+        {
+            auto n = std::to_string(i);
+            p.source += "#if __has_include(<" + headers[i]->getData() + ">)\n";
+            p.source += "char cppan_info" + n + "[] = \"" + info_key(i) + "1]\";\n";
+            p.source += "#else\n";
+            p.source += "char cppan_info" + n + "[] = \"" + info_key(i) + "0]\";\n";
+            p.source += "#endif\n";
+        }
+        p.source += info_main(headers.size());
+
+        std::vector<CheckPtr> existing;
+        path out;
+        if (build(first, p, out))
+        {
+            auto obj = read_file(out, true);
+            for (size_t i = 0; i < headers.size(); i++)
+            {
+                Check::Value v = 0;
+                if (!read_info(obj, i, v))
+                {
+                    existing = headers;
+                    break;
+                }
+                if (v)
+                    existing.push_back(headers[i]);
+                else
+                    headers[i]->setValue(0);
+            }
+        }
+        else
+            existing = headers;
+
+        if (existing.size() < 2)
+        {
+            for (auto &c : existing)
+                execute(std::vector<CheckPtr>{ c });
+            return;
+        }
+
+        // a shared unit could hide a header that needs another one from the batch
+        Strings sources;
+        for (auto &c : existing)
+            sources.push_back(getProbe(*c).source);
+        if (!compile(first, p.cpp, sources))
+        {
+            if (existing.size() == batch.size())
+                return bisect();
+            for (auto &c : existing)
+                execute(std::vector<CheckPtr>{ c });
+            return;
+        }
+        for (auto &c : existing)
+            c->setValue(1);
+        return;
+    }
+    case Check::Type:
+    case Check::Alignment:
+    {
+        p.type = Probe::Info;
+        p.preamble = getPreamble(first);
+        for (size_t i = 0; i < batch.size(); i++)
+            p.source += info_source(*batch[i], i);
+        p.source += info_main(batch.size());
+
+        path out;
+        if (!build(first, p, out))
+            return bisect();
+
+        auto obj = read_file(out, true);
+        std::vector<Check::Value> values(batch.size());
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            if (!read_info(obj, i, values[i]))
+                return bisect();
+        }
+        for (size_t i = 0; i < batch.size(); i++)
+            batch[i]->setValue(values[i]);
+        return;
+    }
+    case Check::Function:
+    {
+        p.type = Probe::Link;
+        p.source = "#ifdef __cplusplus\nextern \"C\" {\n#endif\n";
+        for (auto &c : batch)
+            p.source += "char " + c->getData() + "(void);\n";
+        p.source += "#ifdef __cplusplus\n}\n#endif\n\nint main(void)\n{\n";
+        for (auto &c : batch)
+            p.source += "    " + c->getData() + "();\n";
+        p.source += "    return 0;\n}\n";
+
+        path out;
+        if (!build(first, p, out))
+            return bisect();
+        for (auto &c : batch)
+            c->setValue(1);
+        return;
+    }
+    default:
+        for (auto &c : batch)
+            execute(std::vector<CheckPtr>{ c });
+        return;
+    }
+}
+
+Checks NativeChecker::run(Checks &checks, int N, CheckDurations &durations)
+{
+    Checks native;
+    for (auto &c : checks.checks)
+    {
+        if (canCheck(*c))
+            native.checks.insert(c);
+    }
+    if (native.empty())
+        return native;
+
+    fs::create_directories(dir);
+
+    // group checks that can share one translation unit
+    using BatchKey = std::tuple<int, bool, CheckParameters>;
+    std::map<BatchKey, std::vector<CheckPtr>> groups;
+    std::vector<std::vector<CheckPtr>> batches;
+    for (auto &c : native.checks)
+    {
+        switch (c->getInformation().type)
+        {
+        case Check::Include:
+        case Check::Function:
+            groups[BatchKey{ c->getInformation().type, c->get_cpp(), c->parameters }].push_back(c);
+            break;
+        case Check::Type:
+        case Check::Alignment:
+            // both are read from the object file, so they can go together
+            groups[BatchKey{ Check::Type, c->get_cpp(), c->parameters }].push_back(c);
+            break;
+        default:
+            batches.push_back({ c });
+            break;
+        }
+    }
+    for (auto &g : groups)
+    {
+        auto &v = g.second;
+        // keep all threads busy, but do not make failed batches too expensive
+        size_t size = std::max<size_t>(4, std::min<size_t>(32, (v.size() + N - 1) / N));
+        for (size_t i = 0; i < v.size(); i += size)
+            batches.emplace_back(v.begin() + i, v.begin() + std::min(v.size(), i + size));
+    }
+
+    // longest batches go first, idle threads take the next one from the queue
+    auto cost = [&durations](const std::vector<CheckPtr> &b)
+    {
+        int64_t t = 0;
+        for (auto &c : b)
+            t += durations.get(*c);
+        return t;
+    };
+    std::stable_sort(batches.begin(), batches.end(), [&cost](const auto &a, const auto &b)
+    {
+        return cost(a) > cost(b);
+    });
+
+    Executor e(N, "Native checker");
+    e.throw_exceptions = true;
+
+    // headers used by several probes are precompiled once
+    std::map<String, std::pair<CheckPtr, int>> preambles;
+    for (auto &b : batches)
+    {
+        auto pr = getPreamble(*b[0]);
+        if (pr.empty())
+            continue;
+        auto &v = preambles[getPchKey(*b[0], pr)];
+        v.first = b[0];
+        v.second++;
+    }
+    for (auto &pr : preambles)
+    {
+        if (pr.second.second < 2)
+            continue;
+        auto &pch = pchs[pr.first];
+        e.push([this, &pr, &pch]
+        {
+            precompile(*pr.second.first, getPreamble(*pr.second.first), pch);
+        });
+    }
+    e.wait();
+    for (auto i = pchs.begin(); i != pchs.end();)
+    {
+        if (i->second.empty())
+            i = pchs.erase(i);
+        else
+            ++i;
+    }
+
+    std::mutex m;
+    for (auto &b : batches)
+    {
+        e.push([this, &b, &m, &durations]
+        {
+            auto t = get_time<std::chrono::milliseconds>([this, &b] { execute(b); });
+            std::unique_lock<std::mutex> lk(m);
+            for (auto &c : b)
+                durations.set(*c, t / (int64_t)b.size());
+        });
+    }
+    e.wait();
+
+    LOG_DEBUG(logger, "-- Native checks: " << native.checks.size() << " checks, " << n_probes << " compiler runs, " <<
+        pchs.size() << " precompiled headers");
+
+    for (auto &c : native.checks)
+        checks.checks.erase(c);
+    return native;
+}
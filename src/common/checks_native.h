@@ -0,0 +1,88 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "checks.h"
+
+#include <atomic>
+#include <map>
+#include <vector>
+
+/// Evaluates checks by calling the compiler directly instead of
+/// running a cmake process per worker.
+/// Compiler is taken from the CMakeFiles dir of the test run.
+class NativeChecker
+{
+    struct Compiler
+    {
+        path program;
+        String id;
+        // MSVC for clang-cl
+        String simulate_id;
+        Strings args;
+    };
+
+    struct Probe
+    {
+        enum
+        {
+            Compile,
+            Link,
+            Run,
+            Info, // value is read from the object file
+        };
+
+        int type = Compile;
+        bool cpp = false;
+        // headers shared with other probes, may be precompiled
+        String preamble;
+        String source;
+    };
+
+public:
+    NativeChecker(const ParallelCheckOptions &options);
+
+    // false when the compiler is unknown or cannot be called directly (msvc etc.)
+    bool isAvailable() const { return available; }
+    bool canCheck(const Check &c) const;
+
+    // evaluates supported checks and moves them from 'checks' to the result,
+    // measured durations are recorded
+    Checks run(Checks &checks, int N, CheckDurations &durations);
+
+private:
+    path dir;
+    Compiler c;
+    Compiler cxx;
+    bool available = false;
+    bool crosscompiling = false;
+    std::atomic_int n_probes{ 0 };
+    // pch key -> header to force include
+    std::map<String, path> pchs;
+
+    static String getPreamble(const Check &c);
+    String getPchKey(const Check &c, const String &preamble) const;
+    void precompile(const Check &c, const String &preamble, path &pch);
+    Probe getProbe(const Check &c) const;
+    bool build(const Check &c, const Probe &p, path &out);
+    // every source is a separate translation unit, only syntax is checked
+    bool compile(const Check &c, bool cpp, const Strings &sources);
+    bool execute(const Check &c, Check::Value &value);
+    // compatible checks are probed together, on failure the batch is split
+    void execute(const std::vector<CheckPtr> &batch);
+    Strings getArgs(const Compiler &c, const CheckParameters &p) const;
+};
@@ -188,12 +188,11 @@ yaml Config::save()
 
 void Config::clear_vars_cache() const
 {
-    for (auto &f : boost::make_iterator_range(fs::recursive_directory_iterator(directories.storage_dir_cfg), {}))
-    {
-        if (!fs::is_regular_file(f))
-            continue;
-        remove_file(f);
-    }
+    for (auto &f : walk_directory(directories.storage_dir_cfg))
+        remove_file(f.p);
+
+    // values shared between projects
+    getServiceDatabase().clearCheckResults();
 }
 
 Project &Config::getProject1(const ProjectPath &ppath)
@@ -250,6 +249,7 @@ void Config::post_download() const
     AccessTable at;
     at.remove(pkg.getDirSrc());
     at.remove(pkg.getDirObj());
+    getServiceDatabase().removeGeneratedPackage(pkg);
 
     auto printer = Printer::create(Settings::get_local_settings().printerType);
     printer->d = pkg;
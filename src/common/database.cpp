@@ -15,6 +15,7 @@
  */
 
 #include "database.h"
+#include "database_detail.h"
 
 #include "directories.h"
 #include "exceptions.h"
@@ -22,12 +23,14 @@
 #include "hash.h"
 #include "http.h"
 #include "lock.h"
+#include "packages_snapshot.h"
 #include "settings.h"
 #include "sqlite_database.h"
 #include "stamp.h"
 #include "printers/cmake.h"
 
 #include <primitives/command.h>
+#include <primitives/executor.h>
 #include <primitives/lock.h>
 #include <primitives/pack.h>
 #include <primitives/templates.h>
@@ -37,6 +40,10 @@
 #include <boost/nowide/fstream.hpp>
 #include <sqlite3.h>
 
+#include <deque>
+#include <sstream>
+#include <unordered_set>
+
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "db");
 
@@ -54,10 +61,18 @@ const String db_version_url = "https://raw.githubusercontent.com/cppan/database/
 const path db_dir_name = "database";
 const path db_repo_dir_name = "repository";
 const String packages_db_name = "packages.db";
+const String packages_snapshot_prefix = "packages.";
+const String packages_snapshot_ext = ".snapshot";
 const String service_db_name = "service.db";
 
 TYPED_EXCEPTION(NoSuchVersion);
 
+// versioned name, so a mapped snapshot is never replaced
+path get_snapshot_filename(const path &db_dir, int db_version)
+{
+    return db_dir / (packages_snapshot_prefix + std::to_string(db_version) + packages_snapshot_ext);
+}
+
 std::vector<StartupAction> startup_actions{
     { 1, StartupAction::ClearCache },
     { 2, StartupAction::ServiceDbClearConfigHashes },
@@ -71,6 +86,8 @@ std::vector<StartupAction> startup_actions{
     { 11, StartupAction::ServiceDbClearConfigHashes },
     { 12, StartupAction::ClearStorageDirExp | StartupAction::ClearStorageDirObj },
     { 13, StartupAction::ClearStorageDirExp },
+    { 14, StartupAction::CheckSchema },
+    { 15, StartupAction::CheckSchema },
 };
 
 const TableDescriptors &get_service_tables()
@@ -101,6 +118,7 @@ const TableDescriptors &get_service_tables()
             CREATE TABLE "FileStamps" (
                 "file" TEXT NOT NULL,
                 "stamp" INTEGER NOT NULL,
+                "hash" TEXT NOT NULL,
                 PRIMARY KEY ("file")
             );
         )" },
@@ -155,10 +173,11 @@ const TableDescriptors &get_service_tables()
         R"(
             CREATE TABLE "SourceGroups" (
                 "id" INTEGER NOT NULL,
-                "package_id" INTEGER NOT NULL,
+                "package" TEXT NOT NULL,        -- package hash
+                "stamp" TEXT NOT NULL,          -- package source stamp
                 "path" TEXT NOT NULL,
                 PRIMARY KEY ("id"),
-                FOREIGN KEY ("package_id") REFERENCES "InstalledPackages" ("id") ON DELETE CASCADE
+                UNIQUE ("package", "path")
             );
         )" },
 
@@ -188,6 +207,67 @@ const TableDescriptors &get_service_tables()
                 PRIMARY KEY ("tbl")
             );
         )"},
+
+        {"ResolvedDependencies",
+         R"(
+            CREATE TABLE "ResolvedDependencies" (
+                "hash" TEXT NOT NULL,                   -- requested packages + remote hash
+                "packages_db_version" INTEGER NOT NULL,
+                "dependencies" TEXT NOT NULL,           -- serialized id dependencies
+                PRIMARY KEY ("hash")
+            );
+        )"},
+
+        {"PackageDownloads",
+         R"(
+            CREATE TABLE "PackageDownloads" (
+                "package" TEXT NOT NULL,
+                "archive_size" INTEGER NOT NULL,
+                "download_time" INTEGER NOT NULL,   -- ms
+                "unpack_time" INTEGER NOT NULL,     -- ms
+                PRIMARY KEY ("package")
+            );
+        )"},
+
+        {"GeneratedPackages",
+         R"(
+            CREATE TABLE "GeneratedPackages" (
+                "package" TEXT NOT NULL,
+                "hash" TEXT NOT NULL,   -- hash of all printer inputs
+                PRIMARY KEY ("package")
+            );
+        )"},
+
+        {"CheckResults",
+         R"(
+            CREATE TABLE "CheckResults" (
+                "toolchain" TEXT NOT NULL,
+                "hash" TEXT NOT NULL,   -- check hash
+                "value" INTEGER NOT NULL,
+                PRIMARY KEY ("toolchain", "hash")
+            );
+        )"},
+
+        {"CheckDurations",
+         R"(
+            CREATE TABLE "CheckDurations" (
+                "hash" TEXT NOT NULL,   -- check hash
+                "type" INTEGER NOT NULL,
+                "duration" INTEGER NOT NULL,   -- ms
+                PRIMARY KEY ("hash")
+            );
+        )"},
+
+        {"CompilerFingerprints",
+         R"(
+            CREATE TABLE "CompilerFingerprints" (
+                "path" TEXT NOT NULL,
+                "mtime" INTEGER NOT NULL,
+                "size" INTEGER NOT NULL,
+                "fingerprint" TEXT NOT NULL,
+                PRIMARY KEY ("path")
+            );
+        )"},
     };
     return service_tables;
 }
@@ -312,7 +392,7 @@ PackagesDatabase &getPackagesDatabase()
     return db;
 }
 
-Database::Database(const String &name, const TableDescriptors &tds)
+Database::Database(const String &name, const TableDescriptors &tds, bool open_db)
     : tds(tds)
 {
     db_dir = getDbDirectory();
@@ -328,11 +408,11 @@ Database::Database(const String &name, const TableDescriptors &tds)
             created = true;
         }
     }
-    if (!db)
+    if (!db && open_db)
         open();
 }
 
-void Database::open(bool read_only)
+void Database::open(bool read_only) const
 {
     db = std::make_unique<SqliteDatabase>(fn.string(), read_only);
 }
@@ -487,30 +567,40 @@ void ServiceDatabase::performStartupActions() const
             if (a.action & StartupAction::ClearPackagesDatabase)
             {
                 fs::remove(getDbDirectory() / packages_db_name);
+                clearResolvedDependencies();
             }
 
+            // stamps of the removed generated files are dropped too
+            auto clear_dir = [this](const path &dir)
+            {
+                remove_all_from_dir(dir);
+                removeFileStamps(dir);
+            };
+
             if (a.action & StartupAction::ClearStorageDirExp)
             {
-                remove_all_from_dir(directories.storage_dir_exp);
+                clear_dir(directories.storage_dir_exp);
             }
 
             if (a.action & StartupAction::ClearStorageDirObj)
             {
-                remove_all_from_dir(directories.storage_dir_obj);
+                // printed object configs are gone
+                clear_dir(directories.storage_dir_obj);
+                clearGeneratedPackages();
             }
 
             if (a.action & StartupAction::ClearStorageDirBin)
             {
                 // also remove exp to trigger cmake
-                remove_all_from_dir(directories.storage_dir_exp);
-                remove_all_from_dir(directories.storage_dir_bin);
+                clear_dir(directories.storage_dir_exp);
+                clear_dir(directories.storage_dir_bin);
             }
 
             if (a.action & StartupAction::ClearStorageDirLib)
             {
                 // also remove exp to trigger cmake
-                remove_all_from_dir(directories.storage_dir_exp);
-                remove_all_from_dir(directories.storage_dir_lib);
+                clear_dir(directories.storage_dir_exp);
+                clear_dir(directories.storage_dir_lib);
             }
 
             if (a.action & StartupAction::ClearSourceGroups)
@@ -520,6 +610,7 @@ void ServiceDatabase::performStartupActions() const
 
             if (a.action & StartupAction::ClearCfgDirs)
             {
+                clearCheckResults();
                 for (auto &i : boost::make_iterator_range(fs::directory_iterator(directories.storage_dir_cfg), {}))
                 {
                     if (fs::is_directory(i))
@@ -596,28 +687,45 @@ void ServiceDatabase::setTableHash(const String &table, const String &hash) cons
 Stamps ServiceDatabase::getFileStamps() const
 {
     Stamps st;
-    db->execute("select * from FileStamps",
+    db->execute("select file, stamp, hash from FileStamps",
         [&st](SQLITE_CALLBACK_ARGS)
     {
-        st[cols[0]] = std::stoll(cols[1]);
+        auto &s = st[cols[0]];
+        s.time = std::stoll(cols[1]);
+        s.hash = cols[2];
         return 0;
     });
     return st;
 }
 
-void ServiceDatabase::setFileStamps(const Stamps &stamps) const
+void ServiceDatabase::updateFileStamps(const Stamps &changed, const std::vector<path> &removed) const
 {
-    if (stamps.empty())
-    {
-        clearFileStamps();
+    if (changed.empty() && removed.empty())
         return;
+
+    db->execute("BEGIN;");
+    try
+    {
+        auto &del = db->prepare("delete from FileStamps where file = ?");
+        for (auto &p : removed)
+        {
+            del.bindAll(normalize_path(p));
+            db->execute(del);
+        }
+
+        auto &ins = db->prepare("replace into FileStamps values (?, ?, ?)");
+        for (auto &s : changed)
+        {
+            ins.bindAll(normalize_path(s.first), (int64_t)s.second.time, s.second.hash);
+            db->execute(ins);
+        }
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        db->execute("ROLLBACK;");
+        throw;
     }
-    String q = "replace into FileStamps values ";
-    for (auto &s : stamps)
-        q += "('" + normalize_path(s.first) + "', '" + std::to_string(s.second) + "'),";
-    q.resize(q.size() - 1);
-    q += ";";
-    db->execute(q);
 }
 
 void ServiceDatabase::clearFileStamps() const
@@ -625,6 +733,18 @@ void ServiceDatabase::clearFileStamps() const
     db->execute("delete from FileStamps");
 }
 
+void ServiceDatabase::removeFileStamps(const path &dir) const
+{
+    auto d = normalize_path(dir);
+    if (d.empty())
+        return;
+    if (d.back() != '/')
+        d += '/';
+    auto &st = db->prepare("delete from FileStamps where substr(file, 1, ?) = ?");
+    st.bindAll((int64_t)d.size(), d);
+    db->execute(st);
+}
+
 bool ServiceDatabase::isActionPerformed(const StartupAction &action) const
 {
     int n = 0;
@@ -737,65 +857,324 @@ bool ServiceDatabase::hasPackageDependenciesHash(const Package &p, const String
     return has;
 }
 
-void ServiceDatabase::setSourceGroups(const Package &p, const SourceGroups &sgs) const
+bool ServiceDatabase::getResolvedDependencies(const String &hash, int packages_db_version, IdDependencies &deps) const
+{
+    String data;
+    auto &st = db->prepare("select dependencies from ResolvedDependencies where hash = ? and packages_db_version = ?");
+    st.bindAll(hash, packages_db_version);
+    db->execute(st, [&data](const SqliteStatement &st)
+    {
+        data = st.getText(0);
+    });
+    if (data.empty())
+        return false;
+
+    // one package per line: id ppath version flags hash dependency_ids
+    IdDependencies r;
+    std::istringstream ss(data);
+    String line;
+    while (std::getline(ss, line))
+    {
+        std::vector<String> v;
+        boost::split(v, line, boost::is_any_of(" "));
+        if (v.size() != 6)
+            return false;
+        DownloadDependency d;
+        d.id = std::stoll(v[0]);
+        d.ppath = v[1];
+        d.version = v[2];
+        d.flags = decltype(d.flags)(std::stoull(v[3]));
+        d.hash = v[4];
+        std::set<ProjectVersionId> ids;
+        std::vector<String> ids_s;
+        boost::split(ids_s, v[5], boost::is_any_of(","));
+        for (auto &i : ids_s)
+        {
+            if (!i.empty())
+                ids.insert(std::stoll(i));
+        }
+        d.setDependencyIds(ids);
+        r[d.id] = d;
+    }
+    deps = r;
+    return !deps.empty();
+}
+
+void ServiceDatabase::setResolvedDependencies(const String &hash, int packages_db_version, const IdDependencies &deps) const
+{
+    String data;
+    for (auto &d : deps)
+    {
+        data += std::to_string(d.first) + " ";
+        data += d.second.ppath.toString() + " ";
+        data += d.second.version.toString() + " ";
+        data += std::to_string(d.second.flags.to_ullong()) + " ";
+        data += d.second.hash + " ";
+        for (auto &i : d.second.getDependencyIds())
+            data += std::to_string(i) + ",";
+        data += "\n";
+    }
+
+    // entries for other packages db versions will never be hit again
+    auto &del = db->prepare("delete from ResolvedDependencies where packages_db_version <> ?");
+    del.bindAll(packages_db_version);
+    db->execute(del);
+
+    auto &st = db->prepare("replace into ResolvedDependencies values (?, ?, ?)");
+    st.bindAll(hash, packages_db_version, data);
+    db->execute(st);
+}
+
+void ServiceDatabase::removeResolvedDependencies(const String &hash) const
+{
+    auto &st = db->prepare("delete from ResolvedDependencies where hash = ?");
+    st.bindAll(hash);
+    db->execute(st);
+}
+
+void ServiceDatabase::clearResolvedDependencies() const
+{
+    db->execute("delete from ResolvedDependencies");
+}
+
+std::map<String, uintmax_t> ServiceDatabase::getPackageArchiveSizes() const
 {
-    auto id = getInstalledPackageId(p);
-    if (id == 0)
+    std::map<String, uintmax_t> sizes;
+    db->execute("select package, archive_size from PackageDownloads",
+        [&sizes](SQLITE_CALLBACK_ARGS)
+    {
+        sizes[cols[0]] = std::stoull(cols[1]);
+        return 0;
+    });
+    return sizes;
+}
+
+void ServiceDatabase::addPackageDownloads(const std::vector<PackageDownloadTimes> &downloads) const
+{
+    if (downloads.empty())
         return;
-    removeSourceGroups(id);
-    for (auto &sg : sgs)
+
+    db->execute("BEGIN;");
+    try
     {
-        db->execute("insert into SourceGroups (package_id, path) values ('" + std::to_string(id) + "', '" + sg.first + "');");
-        if (!sg.second.empty())
+        auto &st = db->prepare("replace into PackageDownloads values (?, ?, ?, ?)");
+        for (auto &d : downloads)
         {
-            auto sg_id = db->getLastRowId();
-            String q = "insert into SourceGroupFiles values ";
-            for (auto &f : sg.second)
-                q += "('" + std::to_string(sg_id) + "', '" + f + "'),";
-            q.resize(q.size() - 1);
-            q += ";";
-            db->execute(q);
+            st.bindAll(d.package, (int64_t)d.archive_size, d.download_time, d.unpack_time);
+            db->execute(st);
         }
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        db->execute("ROLLBACK;");
+        throw;
     }
 }
 
-SourceGroups ServiceDatabase::getSourceGroups(const Package &p) const
+std::map<String, String> ServiceDatabase::getGeneratedPackages() const
 {
-    SourceGroups sgs;
-    auto id = getInstalledPackageId(p);
-    if (id == 0)
-        return sgs;
-    std::map<int, String> ids;
-    db->execute("select id, path from SourceGroups where package_id = '" + std::to_string(id) + "';",
-        [&ids](SQLITE_CALLBACK_ARGS)
-    {
-        ids[std::stoi(cols[0])] = cols[1];
+    std::map<String, String> hashes;
+    db->execute("select package, hash from GeneratedPackages",
+        [&hashes](SQLITE_CALLBACK_ARGS)
+    {
+        hashes[cols[0]] = cols[1];
         return 0;
     });
-    for (auto &i : ids)
+    return hashes;
+}
+
+void ServiceDatabase::setGeneratedPackages(const std::map<String, String> &hashes) const
+{
+    if (hashes.empty())
+        return;
+
+    db->execute("BEGIN;");
+    try
     {
-        auto &sg = sgs[i.second];
-        db->execute("select path from SourceGroupFiles where source_group_id = '" + std::to_string(i.first) + "';",
-            [&sg](SQLITE_CALLBACK_ARGS)
+        auto &st = db->prepare("replace into GeneratedPackages values (?, ?)");
+        for (auto &h : hashes)
         {
-            sg.insert(cols[0]);
-            return 0;
-        });
+            st.bindAll(h.first, h.second);
+            db->execute(st);
+        }
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        db->execute("ROLLBACK;");
+        throw;
     }
-    return sgs;
 }
 
-void ServiceDatabase::removeSourceGroups(const Package &p) const
+void ServiceDatabase::removeGeneratedPackage(const Package &p) const
+{
+    auto &st = db->prepare("delete from GeneratedPackages where package = ?");
+    st.bindAll(p.target_name);
+    db->execute(st);
+}
+
+void ServiceDatabase::clearGeneratedPackages() const
+{
+    db->execute("delete from GeneratedPackages");
+}
+
+std::map<String, int> ServiceDatabase::getCheckResults(const String &toolchain_hash) const
+{
+    std::map<String, int> results;
+    auto &st = db->prepare("select hash, value from CheckResults where toolchain = ?");
+    st.bindAll(toolchain_hash);
+    db->execute(st, [&results](const SqliteStatement &st)
+    {
+        results[st.getText(0)] = (int)st.getInt64(1);
+    });
+    return results;
+}
+
+void ServiceDatabase::setCheckResults(const String &toolchain_hash, const std::map<String, int> &results) const
+{
+    if (results.empty())
+        return;
+
+    db->execute("BEGIN;");
+    try
+    {
+        auto &st = db->prepare("replace into CheckResults values (?, ?, ?)");
+        for (auto &r : results)
+        {
+            st.bindAll(toolchain_hash, r.first, r.second);
+            db->execute(st);
+        }
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        db->execute("ROLLBACK;");
+        throw;
+    }
+}
+
+void ServiceDatabase::clearCheckResults() const
+{
+    db->execute("delete from CheckResults");
+}
+
+std::map<String, std::pair<int, int64_t>> ServiceDatabase::getCheckDurations() const
+{
+    std::map<String, std::pair<int, int64_t>> durations;
+    db->execute("select hash, type, duration from CheckDurations",
+        [&durations](SQLITE_CALLBACK_ARGS)
+    {
+        durations[cols[0]] = { std::stoi(cols[1]), std::stoll(cols[2]) };
+        return 0;
+    });
+    return durations;
+}
+
+void ServiceDatabase::setCheckDurations(const std::map<String, std::pair<int, int64_t>> &durations) const
+{
+    if (durations.empty())
+        return;
+
+    db->execute("BEGIN;");
+    try
+    {
+        auto &st = db->prepare("replace into CheckDurations values (?, ?, ?)");
+        for (auto &d : durations)
+        {
+            st.bindAll(d.first, d.second.first, d.second.second);
+            db->execute(st);
+        }
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        db->execute("ROLLBACK;");
+        throw;
+    }
+}
+
+String ServiceDatabase::getCompilerFingerprint(const path &p, time_t mtime, uintmax_t size) const
+{
+    String fp;
+    auto &st = db->prepare("select fingerprint from CompilerFingerprints where path = ? and mtime = ? and size = ?");
+    st.bindAll(normalize_path(p), (int64_t)mtime, (int64_t)size);
+    db->execute(st, [&fp](const SqliteStatement &st)
+    {
+        fp = st.getText(0);
+    });
+    return fp;
+}
+
+void ServiceDatabase::setCompilerFingerprint(const path &p, time_t mtime, uintmax_t size, const String &fingerprint) const
+{
+    auto &st = db->prepare("replace into CompilerFingerprints values (?, ?, ?, ?)");
+    st.bindAll(normalize_path(p), (int64_t)mtime, (int64_t)size, fingerprint);
+    db->execute(st);
+}
+
+void ServiceDatabase::setSourceGroups(const std::map<Package, SourceGroups> &sgs) const
 {
-    auto id = getInstalledPackageId(p);
-    if (id == 0)
+    if (sgs.empty())
         return;
-    removeSourceGroups(id);
+
+    db->execute("BEGIN;");
+    try
+    {
+        auto &st_sg = db->prepare("insert into SourceGroups (package, stamp, path) values (?, ?, ?)");
+        auto &st_f = db->prepare("insert into SourceGroupFiles values (?, ?)");
+        for (auto &[p, groups] : sgs)
+        {
+            removeSourceGroups(p);
+            auto stamp = p.getStampHash();
+            for (auto &sg : groups)
+            {
+                st_sg.bindAll(p.getHash(), stamp, sg.first);
+                db->execute(st_sg);
+                auto sg_id = db->getLastRowId();
+                for (auto &f : sg.second)
+                {
+                    st_f.bindAll(sg_id, f);
+                    db->execute(st_f);
+                }
+            }
+        }
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        db->execute("ROLLBACK;");
+        throw;
+    }
 }
 
-void ServiceDatabase::removeSourceGroups(int id) const
+SourceGroups ServiceDatabase::getSourceGroups(const Package &p) const
 {
-    db->execute("delete from SourceGroups where package_id = '" + std::to_string(id) + "';");
+    SourceGroups sgs;
+    // groups of an older source archive are ignored
+    auto &st = db->prepare(
+        "select SourceGroups.path, SourceGroupFiles.path from SourceGroups "
+        "left join SourceGroupFiles on SourceGroupFiles.source_group_id = SourceGroups.id "
+        "where package = ? and stamp = ?");
+    st.bindAll(p.getHash(), p.getStampHash());
+    db->execute(st, [&sgs](const SqliteStatement &st)
+    {
+        auto &sg = sgs[st.getText(0)];
+        auto f = st.getText(1);
+        if (!f.empty())
+            sg.insert(f);
+    });
+    return sgs;
+}
+
+void ServiceDatabase::removeSourceGroups(const Package &p) const
+{
+    auto &st_f = db->prepare("delete from SourceGroupFiles where source_group_id in (select id from SourceGroups where package = ?)");
+    st_f.bindAll(p.getHash());
+    db->execute(st_f);
+    auto &st_sg = db->prepare("delete from SourceGroups where package = ?");
+    st_sg.bindAll(p.getHash());
+    db->execute(st_sg);
 }
 
 void ServiceDatabase::clearSourceGroups() const
@@ -864,7 +1243,7 @@ PackagesSet ServiceDatabase::getInstalledPackages() const
 }
 
 PackagesDatabase::PackagesDatabase()
-    : Database(packages_db_name, data_tables)
+    : Database(packages_db_name, data_tables, false)
 {
     db_repo_dir = db_dir / db_repo_dir_name;
 
@@ -873,8 +1252,35 @@ PackagesDatabase::PackagesDatabase()
         init();
     };
 
-    // at the end we always reopen packages db as read only
-    open(true);
+    // snapshot is shared between threads
+    static const std::shared_ptr<const PackagesSnapshot> s = [this]() -> std::shared_ptr<const PackagesSnapshot>
+    {
+        try
+        {
+            auto v = readPackagesDbVersion(db_repo_dir);
+            return std::make_shared<PackagesSnapshot>(get_snapshot_filename(db_dir, v), v);
+        }
+        catch (std::exception &e)
+        {
+            LOG_DEBUG(logger, "Packages snapshot is not used: " << e.what());
+        }
+        return nullptr;
+    }();
+    snapshot = s;
+
+    // sqlite db is opened on the first query that the snapshot cannot answer
+    db.reset();
+    if (!snapshot)
+        open(true);
+}
+
+SqliteDatabase &PackagesDatabase::getDb() const
+{
+    if (unusable)
+        throw std::runtime_error("Packages database was not loaded, run the command again");
+    if (!db)
+        open(true);
+    return *db;
 }
 
 void PackagesDatabase::init()
@@ -902,8 +1308,13 @@ void PackagesDatabase::init()
             // multiprocess aware
             single_process_job(get_lock("db_update"), [this]
             {
+                if (!db)
+                    open();
+                // keep current data to apply only the difference after download
+                auto old_tables = readTables();
                 download();
-                load(true);
+                if (!update(old_tables))
+                    load(true);
             });
         }
     }
@@ -973,6 +1384,34 @@ void PackagesDatabase::download()
     writeDownloadTime();
 }
 
+// splits data in place: separators become zeros, fields point into data
+void parse_csv(String &data, int n_cols, std::vector<const char *> &fields)
+{
+    if (data.empty())
+        return;
+    if (data.back() != '\n')
+        data += '\n';
+
+    auto b = &data[0];
+    auto e = b + data.size();
+    while (b < e)
+    {
+        auto eol = std::find(b, e, '\n');
+        *eol = 0;
+        if (b != eol)
+        {
+            for (int i = 0; i < n_cols; i++)
+            {
+                auto sep = std::find(b, eol, ';');
+                *sep = 0;
+                fields.push_back(b == sep ? nullptr : b);
+                b = sep < eol ? sep + 1 : eol;
+            }
+        }
+        b = eol + 1;
+    }
+}
+
 void PackagesDatabase::load(bool drop)
 {
     auto &sdb = getServiceDatabase();
@@ -991,63 +1430,318 @@ void PackagesDatabase::load(bool drop)
         sdb.setPackagesDbSchemaVersion(sver);
     }
 
+    struct TableData
+    {
+        const TableDescriptor *td;
+        int n_cols;
+        String data;
+        // n_cols pointers per row, nullptr means null value
+        std::vector<const char *> fields;
+        // secondary indexes (name, sql) are dropped during import
+        // and recreated at the end
+        std::vector<std::pair<String, String>> indexes;
+    };
+
+    std::vector<TableData> tables;
+    for (auto &td : data_tables)
+        tables.push_back({ &td, db->getNumberOfColumns(td.name) });
+
+    // read and parse files in parallel, inserts are done in one thread below
+    {
+        Executor e(tables.size(), "Db load thread");
+        e.throw_exceptions = true;
+        for (auto &t : tables)
+        {
+            e.push([this, &t]
+            {
+                auto fn = db_repo_dir / (t.td->name + ".csv");
+                if (!fs::exists(fn))
+                    throw std::runtime_error("Cannot open file " + fn.string() + " for reading");
+                t.data = read_file(fn, true);
+                parse_csv(t.data, t.n_cols, t.fields);
+            });
+        }
+        e.wait();
+    }
+
+    auto get_pragma = [this](const String &name)
+    {
+        String v;
+        db->execute("PRAGMA " + name + ";", [&v](SQLITE_CALLBACK_ARGS)
+        {
+            v = cols[0];
+            return 0;
+        });
+        return v;
+    };
+
+    // journaling is turned off for the import,
+    // so on failure we remove the database and it will be recreated on the next run
+    auto journal_mode = get_pragma("journal_mode");
+    auto synchronous = get_pragma("synchronous");
+    db->execute("PRAGMA journal_mode = OFF;");
+    db->execute("PRAGMA synchronous = OFF;");
     db->execute("PRAGMA foreign_keys = OFF;");
 
     auto mdb = db->getDb();
     sqlite3_stmt *stmt = nullptr;
 
-    db->execute("BEGIN;");
+    try
+    {
+        db->execute("BEGIN;");
+
+        for (auto &t : tables)
+        {
+            auto &td = *t.td;
+
+            db->execute("select name, sql from sqlite_master where type = 'index' and "
+                "tbl_name = '" + td.name + "' and sql is not null",
+                [&t](SQLITE_CALLBACK_ARGS)
+            {
+                t.indexes.emplace_back(cols[0], cols[1]);
+                return 0;
+            });
+            for (auto &i : t.indexes)
+                db->execute("DROP INDEX \"" + i.first + "\";");
+
+            if (drop)
+                db->execute("delete from " + td.name);
+
+            String query = "insert into " + td.name + " values (";
+            for (int i = 0; i < t.n_cols; i++)
+                query += "?, ";
+            query.resize(query.size() - 2);
+            query += ");";
+
+            if (sqlite3_prepare_v2(mdb, query.c_str(), (int)query.size() + 1, &stmt, 0) != SQLITE_OK)
+                throw std::runtime_error(sqlite3_errmsg(mdb));
+
+            // data is kept alive until the end of the import, so no copies are made
+            for (auto f = t.fields.begin(); f != t.fields.end(); f += t.n_cols)
+            {
+                for (int i = 0; i < t.n_cols; i++)
+                {
+                    if (f[i])
+                        sqlite3_bind_text(stmt, i + 1, f[i], -1, SQLITE_STATIC);
+                    else
+                        sqlite3_bind_null(stmt, i + 1);
+                }
+
+                if (sqlite3_step(stmt) != SQLITE_DONE)
+                    throw std::runtime_error("sqlite3_step() failed");
+                if (sqlite3_reset(stmt) != SQLITE_OK)
+                    throw std::runtime_error("sqlite3_reset() failed");
+            }
+
+            auto rc = sqlite3_finalize(stmt);
+            stmt = nullptr;
+            if (rc != SQLITE_OK)
+                throw std::runtime_error("sqlite3_finalize() failed");
 
+            for (auto &i : t.indexes)
+                db->execute(i.second);
+        }
+
+        db->execute("COMMIT;");
+    }
+    catch (...)
+    {
+        sqlite3_finalize(stmt);
+        db.reset();
+        fs::remove(fn);
+        unusable = true;
+        throw;
+    }
+
+    db->execute("PRAGMA foreign_keys = ON;");
+    db->execute("PRAGMA synchronous = " + synchronous + ";");
+    db->execute("PRAGMA journal_mode = " + journal_mode + ";");
+    writeSnapshot();
+}
+
+PackagesDatabase::TablesData PackagesDatabase::readTables() const
+{
+    TablesData tables;
     for (auto &td : data_tables)
     {
-        if (drop)
-            db->execute("delete from " + td.name);
+        auto fn = db_repo_dir / (td.name + ".csv");
+        if (fs::exists(fn))
+            tables[td.name] = read_file(fn, true);
+    }
+    return tables;
+}
 
-        auto n_cols = db->getNumberOfColumns(td.name);
+static std::unordered_set<String> split_rows(const String &data)
+{
+    std::unordered_set<String> lines;
+    size_t b = 0;
+    while (b < data.size())
+    {
+        auto e = data.find('\n', b);
+        if (e == data.npos)
+            e = data.size();
+        if (e != b)
+            lines.insert(data.substr(b, e - b));
+        b = e + 1;
+    }
+    return lines;
+}
 
-        String query = "insert into " + td.name + " values (";
-        for (int i = 0; i < n_cols; i++)
-            query += "?, ";
-        query.resize(query.size() - 2);
-        query += ");";
+bool get_table_delta(const SqliteDatabase &db, const TableDescriptor &td, const String &old_data, const String &new_data, TableDelta &d)
+{
+    auto old_lines = split_rows(old_data);
+    auto new_lines = split_rows(new_data);
 
-        if (sqlite3_prepare_v2(mdb, query.c_str(), (int)query.size() + 1, &stmt, 0) != SQLITE_OK)
-            throw std::runtime_error(sqlite3_errmsg(mdb));
+    // changed rows are deleted by key and inserted again
+    d = TableDelta{ &td, db.getNumberOfColumns(td.name) };
+    for (auto &l : old_lines)
+    {
+        if (new_lines.find(l) == new_lines.end())
+        {
+            d.deleted += l + "\n";
+            d.n_deleted++;
+        }
+    }
+    for (auto &l : new_lines)
+    {
+        if (old_lines.find(l) == old_lines.end())
+        {
+            d.inserted += l + "\n";
+            d.n_inserted++;
+        }
+    }
 
-        auto fn = db_repo_dir / (td.name + ".csv");
-        boost::nowide::ifstream ifile(fn.string());
-        if (!ifile)
-            throw std::runtime_error("Cannot open file " + fn.string() + " for reading");
+    // rows are deleted by primary key
+    std::map<int, std::pair<int, String>> pk;
+    db.execute("pragma table_info(" + td.name + ");", [&pk](SQLITE_CALLBACK_ARGS)
+    {
+        // cid, name, type, notnull, dflt_value, pk
+        if (std::stoi(cols[5]))
+            pk[std::stoi(cols[5])] = { std::stoi(cols[0]), cols[1] };
+        return 0;
+    });
+    if (pk.empty())
+        return false;
+    d.delete_query = "delete from " + td.name + " where ";
+    for (auto &c : pk)
+    {
+        d.pk.push_back(c.second.first);
+        d.delete_query += "\"" + c.second.second + "\" = ? and ";
+    }
+    d.delete_query.resize(d.delete_query.size() - 5);
+    return true;
+}
 
-        String s;
-        while (std::getline(ifile, s))
+void apply_table_delta(const SqliteDatabase &db, TableDelta &d)
+{
+    std::vector<const char *> fields;
+    parse_csv(d.deleted, d.n_cols, fields);
+    auto &del = db.prepare(d.delete_query);
+    for (auto f = fields.begin(); f != fields.end(); f += d.n_cols)
+    {
+        int i = 1;
+        for (auto &c : d.pk)
         {
-            auto b = s.c_str();
-            std::replace(s.begin(), s.end(), ';', '\0');
+            if (f[c])
+                del.bind(i++, String(f[c]));
+            else
+                del.bindNull(i++);
+        }
+        db.execute(del);
+    }
 
-            for (int i = 1; i <= n_cols; i++)
-            {
-                if (*b)
-                    sqlite3_bind_text(stmt, i, b, -1, SQLITE_TRANSIENT);
-                else
-                    sqlite3_bind_null(stmt, i);
-                while (*b) b++;
-                b++;
-            }
+    String q = "insert into " + d.td->name + " values (";
+    for (int i = 0; i < d.n_cols; i++)
+        q += "?, ";
+    q.resize(q.size() - 2);
+    q += ");";
 
-            if (sqlite3_step(stmt) != SQLITE_DONE)
-                throw std::runtime_error("sqlite3_step() failed");
-            if (sqlite3_reset(stmt) != SQLITE_OK)
-                throw std::runtime_error("sqlite3_reset() failed");
+    fields.clear();
+    parse_csv(d.inserted, d.n_cols, fields);
+    auto &ins = db.prepare(q);
+    for (auto f = fields.begin(); f != fields.end(); f += d.n_cols)
+    {
+        for (int i = 0; i < d.n_cols; i++)
+        {
+            if (f[i])
+                ins.bind(i + 1, String(f[i]));
+            else
+                ins.bindNull(i + 1);
         }
+        db.execute(ins);
+    }
+}
 
-        if (sqlite3_finalize(stmt) != SQLITE_OK)
-            throw std::runtime_error("sqlite3_finalize() failed");
+bool PackagesDatabase::update(const TablesData &old_tables)
+{
+    // schema changes require full reload
+    if (old_tables.size() != data_tables.size())
+        return false;
+    if (readPackagesDbSchemaVersion(db_repo_dir) != getServiceDatabase().getPackagesDbSchemaVersion())
+        return false;
+
+    std::vector<TableDelta> deltas;
+    size_t n_deleted = 0;
+    size_t n_inserted = 0;
+    for (auto &td : data_tables)
+    {
+        auto fn = db_repo_dir / (td.name + ".csv");
+        if (!fs::exists(fn))
+            return false;
+        TableDelta d;
+        if (!get_table_delta(*db, td, old_tables.find(td.name)->second, read_file(fn, true), d))
+            return false;
+        n_deleted += d.n_deleted;
+        n_inserted += d.n_inserted;
+        deltas.push_back(std::move(d));
     }
 
-    db->execute("COMMIT;");
+    LOG_INFO(logger, "Updating database: " << n_inserted << " rows inserted or changed, " << n_deleted << " rows deleted or changed");
 
+    db->execute("PRAGMA foreign_keys = OFF;");
+    db->execute("BEGIN;");
+    try
+    {
+        for (auto &d : deltas)
+            apply_table_delta(*db, d);
+        db->execute("COMMIT;");
+    }
+    catch (std::exception &e)
+    {
+        db->execute("ROLLBACK;");
+        db->execute("PRAGMA foreign_keys = ON;");
+        LOG_WARN(logger, "Cannot apply database update, reloading: " << e.what());
+        return false;
+    }
     db->execute("PRAGMA foreign_keys = ON;");
+
+    writeSnapshot();
+    return true;
+}
+
+void PackagesDatabase::writeSnapshot() const
+{
+    try
+    {
+        auto version = readPackagesDbVersion(db_repo_dir);
+        auto fn = get_snapshot_filename(db_dir, version);
+        PackagesSnapshot::write(*db, fn, version);
+
+        // old versions, still mapped ones are removed on the next write
+        for (auto &f : boost::make_iterator_range(fs::directory_iterator(db_dir), {}))
+        {
+            auto n = f.path().filename().string();
+            if (f.path() == fn || !boost::starts_with(n, packages_snapshot_prefix) || !boost::ends_with(n, packages_snapshot_ext))
+                continue;
+            boost::system::error_code ec;
+            fs::remove(f, ec);
+        }
+    }
+    catch (std::exception &e)
+    {
+        // snapshot is optional
+        LOG_WARN(logger, "Cannot write packages snapshot: " << e.what());
+    }
 }
 
 void PackagesDatabase::writeDownloadTime() const
@@ -1087,14 +1781,27 @@ IdDependencies PackagesDatabase::findDependencies(const Packages &deps) const
         project.ppath = dep.second.ppath;
         project.version = dep.second.version;
 
-        db->execute("select id, type_id, flags from Projects where path = '" + dep.second.ppath.toString() + "'",
-            [&project, &type](SQLITE_CALLBACK_ARGS)
+        if (snapshot)
         {
-            project.id = std::stoull(cols[0]);
-            type = (ProjectType)std::stoi(cols[1]);
-            project.flags = std::stoull(cols[2]);
-            return 0;
-        });
+            PackagesSnapshot::Project p;
+            if (snapshot->getProject(project.ppath, p))
+            {
+                project.id = p.id;
+                type = p.type;
+                project.flags = p.flags;
+            }
+        }
+        else
+        {
+            auto &st = getDb().prepare("select id, type_id, flags from Projects where path = ?");
+            st.bindAll(dep.second.ppath.toString());
+            getDb().execute(st, [&project, &type](const SqliteStatement &st)
+            {
+                project.id = st.getInt64(0);
+                type = (ProjectType)st.getInt64(1);
+                project.flags = st.getInt64(2);
+            });
+        }
 
         if (project.id == 0)
             // TODO: replace later with typed exception, so client will try to fetch same package from server
@@ -1105,7 +1812,7 @@ IdDependencies PackagesDatabase::findDependencies(const Packages &deps) const
             dependency.flags.set(pfDirectDependency);
             dependency.id = getExactProjectVersionId(dependency, dependency.version, dependency.flags, dependency.hash);
             all_deps[dependency] = dependency; // assign first, deps assign second
-            all_deps[dependency].db_dependencies = getProjectDependencies(dependency.id, all_deps);
+            getProjectDependencies(dependency.id, all_deps);
         };
 
         if (type == ProjectType::RootProject)
@@ -1113,18 +1820,33 @@ IdDependencies PackagesDatabase::findDependencies(const Packages &deps) const
             std::vector<DownloadDependency> projects;
 
             // root projects should return all children (lib, exe)
-            db->execute("select id, path, flags from Projects where path like '" + project.ppath.toString() +
-                ".%' and type_id in ('1','2') order by path",
-                [&projects, &project](SQLITE_CALLBACK_ARGS)
+            if (snapshot)
             {
-                DownloadDependency dep;
-                dep.id = std::stoull(cols[0]);
-                dep.ppath = String(cols[1]);
-                dep.version = project.version;
-                dep.flags = std::stoull(cols[2]);
-                projects.push_back(dep);
-                return 0;
-            });
+                for (auto &p : snapshot->getChildProjects(project.ppath))
+                {
+                    DownloadDependency dep;
+                    dep.id = p.id;
+                    dep.ppath = p.ppath;
+                    dep.version = project.version;
+                    dep.flags = p.flags;
+                    projects.push_back(dep);
+                }
+            }
+            else
+            {
+                auto &st = getDb().prepare("select id, path, flags from Projects where path like ? || '.%' "
+                    "and type_id in ('1','2') order by path");
+                st.bindAll(project.ppath.toString());
+                getDb().execute(st, [&projects, &project](const SqliteStatement &st)
+                {
+                    DownloadDependency dep;
+                    dep.id = st.getInt64(0);
+                    dep.ppath = st.getText(1);
+                    dep.version = project.version;
+                    dep.flags = st.getInt64(2);
+                    projects.push_back(dep);
+                });
+            }
 
             if (projects.empty())
                 // TODO: replace later with typed exception, so client will try to fetch same package from server
@@ -1190,88 +1912,74 @@ ProjectVersionId PackagesDatabase::getExactProjectVersionId(const DownloadDepend
     static auto tstart = getUtc();
 
     ProjectVersionId id = 0;
-    static const String select = "select id, major, minor, patch, flags, hash, created from ProjectVersions where ";
+    static const String select = "select id, major, minor, patch, flags, hash, created from ProjectVersions where project_id = ? and ";
+
+    auto read_version = [&id, &version, &flags, &hash](const SqliteStatement &st)
+    {
+        id = st.getInt64(0);
+        if (!version.isBranch())
+        {
+            version.major = (ProjectVersionNumber)st.getInt64(1);
+            version.minor = (ProjectVersionNumber)st.getInt64(2);
+            version.patch = (ProjectVersionNumber)st.getInt64(3);
+        }
+        flags |= ProjectFlags(st.getInt64(4));
+        hash = st.getText(5);
+        check_version_age(tstart, st.getText(6).c_str());
+    };
+
+    if (snapshot)
+    {
+        PackagesSnapshot::ProjectVersion v;
+        if (!snapshot->selectVersion(project.id, version, v))
+            throw err(version, project.ppath);
+        if (!version.isBranch())
+            version = v.version;
+        flags |= v.flags;
+        hash = v.hash;
+        check_version_age(tstart, v.created.c_str());
+        return v.id;
+    }
+
+    auto pid = (int64_t)project.id;
 
     if (!version.isBranch())
     {
-        auto &v = version;
+        auto v = version;
 
-        db->execute(
-            select + " "
-            "project_id = '" + std::to_string(project.id) + "' and "
-            "major = '" + std::to_string(v.major) + "' and "
-            "minor = '" + std::to_string(v.minor) + "' and "
-            "patch = '" + std::to_string(v.patch) + "'", [&id, &flags, &hash](SQLITE_CALLBACK_ARGS)
-        {
-            id = std::stoull(cols[0]);
-            flags |= decltype(project.flags)(std::stoull(cols[4]));
-            hash = cols[5];
-            check_version_age(tstart, cols[6]);
-            return 0;
-        });
+        auto &st = getDb().prepare(select + "major = ? and minor = ? and patch = ?");
+        st.bindAll(pid, v.major, v.minor, v.patch);
+        getDb().execute(st, read_version);
 
         if (id == 0)
         {
             if (v.patch != -1)
                 throw err(version, project.ppath);
 
-            db->execute(
-                select + " "
-                "project_id = '" + std::to_string(project.id) + "' and "
-                "major = '" + std::to_string(v.major) + "' and "
-                "minor = '" + std::to_string(v.minor) + "' and "
-                "branch is null order by major desc, minor desc, patch desc limit 1",
-                [&id, &version, &flags, &hash](SQLITE_CALLBACK_ARGS)
-            {
-                id = std::stoull(cols[0]);
-                version.patch = std::stoi(cols[3]);
-                flags |= decltype(project.flags)(std::stoull(cols[4]));
-                hash = cols[5];
-                check_version_age(tstart, cols[6]);
-                return 0;
-            });
+            auto &st = getDb().prepare(select + "major = ? and minor = ? and "
+                "branch is null order by major desc, minor desc, patch desc limit 1");
+            st.bindAll(pid, v.major, v.minor);
+            getDb().execute(st, read_version);
 
             if (id == 0)
             {
                 if (v.minor != -1)
                     throw err(version, project.ppath);
 
-                db->execute(
-                    select + " "
-                    "project_id = '" + std::to_string(project.id) + "' and "
-                    "major = '" + std::to_string(v.major) + "' and "
-                    "branch is null order by major desc, minor desc, patch desc limit 1",
-                    [&id, &version, &flags, &hash](SQLITE_CALLBACK_ARGS)
-                {
-                    id = std::stoull(cols[0]);
-                    version.minor = std::stoi(cols[2]);
-                    version.patch = std::stoi(cols[3]);
-                    flags |= decltype(project.flags)(std::stoull(cols[4]));
-                    hash = cols[5];
-                    check_version_age(tstart, cols[6]);
-                    return 0;
-                });
+                auto &st = getDb().prepare(select + "major = ? and "
+                    "branch is null order by major desc, minor desc, patch desc limit 1");
+                st.bindAll(pid, v.major);
+                getDb().execute(st, read_version);
 
                 if (id == 0)
                 {
                     if (v.major != -1)
                         throw err(version, project.ppath);
 
-                    db->execute(
-                        select + " "
-                        "project_id = '" + std::to_string(project.id) + "' and "
-                        "branch is null order by major desc, minor desc, patch desc limit 1",
-                        [&id, &version, &flags, &hash](SQLITE_CALLBACK_ARGS)
-                    {
-                        id = std::stoull(cols[0]);
-                        version.major = std::stoi(cols[1]);
-                        version.minor = std::stoi(cols[2]);
-                        version.patch = std::stoi(cols[3]);
-                        flags |= decltype(project.flags)(std::stoull(cols[4]));
-                        hash = cols[5];
-                        check_version_age(tstart, cols[6]);
-                        return 0;
-                    });
+                    auto &st = getDb().prepare(select +
+                        "branch is null order by major desc, minor desc, patch desc limit 1");
+                    st.bindAll(pid);
+                    getDb().execute(st, read_version);
 
                     if (id == 0)
                     {
@@ -1284,17 +1992,9 @@ ProjectVersionId PackagesDatabase::getExactProjectVersionId(const DownloadDepend
     }
     else
     {
-        db->execute(
-            select + " "
-            "project_id = '" + std::to_string(project.id) + "' and "
-            "branch = '" + version.toString() + "'", [&id, &flags, &hash](SQLITE_CALLBACK_ARGS)
-        {
-            id = std::stoull(cols[0]);
-            flags |= decltype(project.flags)(std::stoull(cols[4]));
-            hash = cols[5];
-            check_version_age(tstart, cols[6]);
-            return 0;
-        });
+        auto &st = getDb().prepare(select + "branch = ?");
+        st.bindAll(pid, version.toString());
+        getDb().execute(st, read_version);
 
         if (id == 0)
         {
@@ -1306,40 +2006,118 @@ ProjectVersionId PackagesDatabase::getExactProjectVersionId(const DownloadDepend
     return id;
 }
 
-PackagesDatabase::Dependencies PackagesDatabase::getProjectDependencies(ProjectVersionId project_version_id, DependenciesMap &dm) const
-{
-    Dependencies dependencies;
-    std::vector<DownloadDependency> deps;
+// Whole transitive closure is computed by a single recursive query.
+// Version selection mirrors getExactProjectVersionId():
+// exact 'x.y.z', the latest 'x.y.*', the latest 'x.*', the latest '*' or a branch.
+// Unresolved edges are returned with null version id.
+static const String select_dependency_version = R"(
+    (select pv.id from ProjectVersions pv
+        where pv.project_id = d.project_dependency_id and (
+            pv.branch = d.version or
+            pv.branch is null and d.version in (
+                '*',
+                cast(pv.major as text),
+                pv.major || '.' || pv.minor,
+                pv.major || '.' || pv.minor || '.' || pv.patch
+            )
+        )
+        order by pv.major desc, pv.minor desc, pv.patch desc limit 1)
+)";
+
+const String dependencies_closure_query = R"(
+    with recursive edges(parent_id, project_id, version, flags, id) as (
+        select d.project_version_id, d.project_dependency_id, d.version, d.flags, )" + select_dependency_version + R"(
+        from ProjectVersionDependencies d
+        where d.project_version_id = ?
+        union
+        select d.project_version_id, d.project_dependency_id, d.version, d.flags, )" + select_dependency_version + R"(
+        from ProjectVersionDependencies d
+        join edges e on d.project_version_id = e.id
+    )
+    select e.parent_id, e.id, p.path, e.version, p.flags, e.flags,
+        pv.major, pv.minor, pv.patch, pv.branch, pv.flags, pv.hash, pv.created
+    from edges e
+    join Projects p on p.id = e.project_id
+    left join ProjectVersions pv on pv.id = e.id
+    order by e.parent_id, p.path
+)";
+
+void PackagesDatabase::getProjectDependencies(ProjectVersionId project_version_id, DependenciesMap &dm) const
+{
+    // see getExactProjectVersionId()
+    static auto tstart = getUtc();
+
+    std::vector<std::pair<ProjectVersionId, DownloadDependency>> edges;
 
-    db->execute(
-        "select Projects.id, path, version, Projects.flags, ProjectVersionDependencies.flags "
-        "from ProjectVersionDependencies join Projects on project_dependency_id = Projects.id "
-        "where project_version_id = '" + std::to_string(project_version_id) + "' order by path",
-        [&deps](SQLITE_CALLBACK_ARGS)
+    auto no_such_version = [](const String &v, const ProjectPath &p)
     {
-        int col_id = 0;
-        DownloadDependency d;
-        d.id = std::stoull(cols[col_id++]);
-        d.ppath = cols[col_id++];
-        d.version = String(cols[col_id++]);
-        d.flags = decltype(d.flags)(std::stoull(cols[col_id++])); // project's flags
-        d.flags |= decltype(d.flags)(std::stoull(cols[col_id++])); // merge with deps' flags
-        deps.push_back(d);
-        return 0;
-    });
+        return NoSuchVersion("No such version/branch '" + Version(v).toAnyVersion() + "' for project '" + p.toString() + "'");
+    };
 
-    for (auto &dependency : deps)
+    if (snapshot)
     {
-        dependency.id = getExactProjectVersionId(dependency, dependency.version, dependency.flags, dependency.hash);
-        auto i = dm.find(dependency);
-        if (i == dm.end())
+        for (auto &e : snapshot->getDependencies(project_version_id))
         {
-            dm[dependency] = dependency; // assign first, deps assign second
-            dm[dependency].db_dependencies = getProjectDependencies(dependency.id, dm);
+            if (!e.resolved)
+                throw no_such_version(e.version, e.project.ppath);
+            DownloadDependency d;
+            d.id = e.selected.id;
+            d.ppath = e.project.ppath;
+            d.version = e.selected.version;
+            d.flags = e.project.flags | e.flags | e.selected.flags;
+            d.hash = e.selected.hash;
+            check_version_age(tstart, e.selected.created.c_str());
+            edges.emplace_back(e.parent, d);
         }
-        dependencies[dependency.ppath.toString()] = dependency;
     }
-    return dependencies;
+    else
+    {
+        auto &st = getDb().prepare(dependencies_closure_query);
+        st.bindAll((int64_t)project_version_id);
+        getDb().execute(st, [&edges, &no_such_version](const SqliteStatement &st)
+        {
+            DownloadDependency d;
+            d.ppath = st.getText(2);
+            if (st.isNull(1))
+                throw no_such_version(st.getText(3), d.ppath);
+            d.id = st.getInt64(1);
+            if (st.isNull(9))
+            {
+                d.version = Version(
+                    (ProjectVersionNumber)st.getInt64(6),
+                    (ProjectVersionNumber)st.getInt64(7),
+                    (ProjectVersionNumber)st.getInt64(8));
+                d.version.type = VersionType::Version;
+            }
+            else
+                d.version = st.getText(9);
+            d.flags = decltype(d.flags)(st.getInt64(4)); // project's flags
+            d.flags |= decltype(d.flags)(st.getInt64(5)); // merge with deps' flags
+            d.flags |= decltype(d.flags)(st.getInt64(10)); // merge with version's flags
+            d.hash = st.getText(11);
+            check_version_age(tstart, st.getText(12).c_str());
+            edges.emplace_back(st.getInt64(0), d);
+        });
+    }
+
+    // add nodes first, then connect them
+    std::map<ProjectVersionId, DownloadDependency *> nodes;
+    for (auto &d : dm)
+        nodes[d.second.id] = &d.second;
+    for (auto &e : edges)
+    {
+        auto i = dm.find(e.second);
+        if (i == dm.end())
+            i = dm.emplace(e.second, e.second).first;
+        nodes[e.second.id] = &i->second;
+    }
+    for (auto &e : edges)
+    {
+        auto i = nodes.find(e.first);
+        if (i == nodes.end())
+            throw std::logic_error("Dependency closure has unknown parent: " + std::to_string(e.first));
+        i->second->db_dependencies[e.second.ppath.toString()] = e.second;
+    }
 }
 
 void PackagesDatabase::listPackages(const String &name) const
@@ -1381,12 +2159,19 @@ template <template <class...> class C>
 C<ProjectPath> PackagesDatabase::getMatchingPackages(const String &name) const
 {
     C<ProjectPath> pkgs;
+    if (snapshot)
+    {
+        for (auto &p : snapshot->getMatchingPackages(name))
+            pkgs.insert(p);
+        return pkgs;
+    }
+
     String q;
     if (name.empty())
         q = "select path from Projects where type_id <> '3' order by path";
     else
         q = "select path from Projects where type_id <> '3' and path like '%" + name + "%' order by path";
-    db->execute(q, [&pkgs](SQLITE_CALLBACK_ARGS)
+    getDb().execute(q, [&pkgs](SQLITE_CALLBACK_ARGS)
     {
         pkgs.insert(String(cols[0]));
         return 0;
@@ -1402,8 +2187,11 @@ PackagesDatabase::getMatchingPackages<std::set>(const String &) const;
 
 std::vector<Version> PackagesDatabase::getVersionsForPackage(const ProjectPath &ppath) const
 {
+    if (snapshot)
+        return snapshot->getVersionsForPackage(ppath);
+
     std::vector<Version> versions;
-    db->execute(
+    getDb().execute(
         "select case when branch is not null then branch else major || '.' || minor || '.' || patch end as version "
         "from ProjectVersions where project_id = '" + std::to_string(getPackageId(ppath)) + "' order by branch, major, minor, patch",
         [&versions](SQLITE_CALLBACK_ARGS)
@@ -1414,10 +2202,21 @@ std::vector<Version> PackagesDatabase::getVersionsForPackage(const ProjectPath &
     return versions;
 }
 
+int PackagesDatabase::getVersion() const
+{
+    return readPackagesDbVersion(db_repo_dir);
+}
+
 ProjectId PackagesDatabase::getPackageId(const ProjectPath &ppath) const
 {
+    if (snapshot)
+    {
+        PackagesSnapshot::Project p;
+        return snapshot->getProject(ppath, p) ? p.id : 0;
+    }
+
     ProjectId id = 0;
-    db->execute("select id from Projects where path = '" + ppath.toString() + "'", [&id](SQLITE_CALLBACK_ARGS)
+    getDb().execute("select id from Projects where path = '" + ppath.toString() + "'", [&id](SQLITE_CALLBACK_ARGS)
     {
         id = std::stoi(cols[0]);
         return 0;
@@ -1425,32 +2224,42 @@ ProjectId PackagesDatabase::getPackageId(const ProjectPath &ppath) const
     return id;
 }
 
-PackagesSet PackagesDatabase::getDependentPackages(const Package &pkg)
+const PackagesDatabase::ReverseDependencies &PackagesDatabase::getReverseDependencies() const
 {
-    PackagesSet r;
-
-    // 1. Find current project version id.
-    ProjectId project_id = getPackageId(pkg.ppath);
+    // built once for all edges, packages db is read only during the run
+    if (reverse_dependencies)
+        return *reverse_dependencies;
 
-    // 2. Find project versions dependent on this version.
-    std::set<std::pair<String, String>> pkgs_s;
-    db->execute(
-        "select path, case when branch is not null then branch else major || '.' || minor || '.' || patch end as version "
+    auto rd = std::make_unique<ReverseDependencies>();
+    getDb().execute(
+        "select project_dependency_id, project_id, path, "
+        "case when branch is not null then branch else major || '.' || minor || '.' || patch end as version "
         "from ProjectVersionDependencies "
         "join ProjectVersions on ProjectVersions.id = project_version_id "
-        "join Projects on Projects.id = project_id "
-        "where project_dependency_id = '" + std::to_string(project_id) + "'",
-        [&pkgs_s](SQLITE_CALLBACK_ARGS)
+        "join Projects on Projects.id = project_id",
+        [&rd](SQLITE_CALLBACK_ARGS)
     {
-        pkgs_s.insert({ cols[0], cols[1] });
+        (*rd)[std::stoull(cols[0])].push_back({ std::stoull(cols[1]), cols[2], cols[3] });
         return 0;
     });
+    reverse_dependencies = std::move(rd);
+    return *reverse_dependencies;
+}
 
-    for (auto &p : pkgs_s)
+PackagesSet PackagesDatabase::getDependentPackages(const Package &pkg)
+{
+    PackagesSet r;
+
+    auto &rd = getReverseDependencies();
+    auto i = rd.find(getPackageId(pkg.ppath));
+    if (i == rd.end())
+        return r;
+
+    for (auto &d : i->second)
     {
         Package pkg;
-        pkg.ppath = p.first;
-        pkg.version = p.second;
+        pkg.ppath = d.ppath;
+        pkg.version = d.version;
         pkg.createNames();
         r.insert(pkg);
     }
@@ -1476,27 +2285,37 @@ PackagesSet PackagesDatabase::getDependentPackages(const PackagesSet &pkgs)
 
 PackagesSet PackagesDatabase::getTransitiveDependentPackages(const PackagesSet &pkgs)
 {
+    // bfs over projects: dependents do not depend on the exact version
+    auto &rd = getReverseDependencies();
+
     auto r = pkgs;
-    std::map<Package, bool> retrieved;
-    while (1)
+    std::set<ProjectId> visited;
+    std::deque<ProjectId> q;
+    for (auto &pkg : pkgs)
     {
-        bool changed = false;
-
-        for (auto &pkg : r)
-        {
-            if (retrieved[pkg])
-                continue;
+        auto id = getPackageId(pkg.ppath);
+        if (visited.insert(id).second)
+            q.push_back(id);
+    }
 
-            retrieved[pkg] = true;
-            changed = true;
+    while (!q.empty())
+    {
+        auto i = rd.find(q.front());
+        q.pop_front();
+        if (i == rd.end())
+            continue;
 
-            auto dpkgs = getDependentPackages(pkg);
-            r.insert(dpkgs.begin(), dpkgs.end());
-            break;
+        for (auto &d : i->second)
+        {
+            Package pkg;
+            pkg.ppath = d.ppath;
+            pkg.version = d.version;
+            pkg.createNames();
+            r.insert(pkg);
+
+            if (visited.insert(d.project_id).second)
+                q.push_back(d.project_id);
         }
-
-        if (!changed)
-            break;
     }
 
     // exclude input
@@ -24,11 +24,22 @@
 
 #include <chrono>
 #include <memory>
+#include <unordered_map>
 #include <vector>
 
+class PackagesSnapshot;
 class SqliteDatabase;
 struct Package;
 
+// one package download, stored after all downloads are done
+struct PackageDownloadTimes
+{
+    String package; // package path
+    uintmax_t archive_size = 0;
+    int64_t download_time = 0; // ms
+    int64_t unpack_time = 0; // ms
+};
+
 struct TableDescriptor
 {
     String name;
@@ -61,14 +72,16 @@ struct StartupAction
 class Database
 {
 public:
-    Database(const String &name, const TableDescriptors &tds);
+    // when open_db is false, db is opened only to create a new file
+    Database(const String &name, const TableDescriptors &tds, bool open_db = true);
     Database(const Database &) = delete;
     Database &operator=(const Database &) = delete;
 
-    void open(bool read_only = false);
+    // db is opened lazily by const queries too
+    void open(bool read_only = false) const;
 
 protected:
-    std::unique_ptr<SqliteDatabase> db;
+    mutable std::unique_ptr<SqliteDatabase> db;
     path fn;
     path db_dir;
     bool created = false;
@@ -113,15 +126,46 @@ public:
     int getInstalledPackageId(const Package &p) const;
     PackagesSet getInstalledPackages() const;
 
-    void setSourceGroups(const Package &p, const SourceGroups &sg) const;
+    void setSourceGroups(const std::map<Package, SourceGroups> &sgs) const;
     SourceGroups getSourceGroups(const Package &p) const;
     void removeSourceGroups(const Package &p) const;
-    void removeSourceGroups(int id) const;
     void clearSourceGroups() const;
 
+    // resolved dependency sets, valid for a single packages db version
+    bool getResolvedDependencies(const String &hash, int packages_db_version, IdDependencies &deps) const;
+    void setResolvedDependencies(const String &hash, int packages_db_version, const IdDependencies &deps) const;
+    void removeResolvedDependencies(const String &hash) const;
+    void clearResolvedDependencies() const;
+
+    // last archive sizes by package path
+    std::map<String, uintmax_t> getPackageArchiveSizes() const;
+    void addPackageDownloads(const std::vector<PackageDownloadTimes> &downloads) const;
+
+    // package target name -> hash of inputs its files were generated from
+    std::map<String, String> getGeneratedPackages() const;
+    void setGeneratedPackages(const std::map<String, String> &hashes) const;
+    void removeGeneratedPackage(const Package &p) const;
+    void clearGeneratedPackages() const;
+
+    // check hash -> value, shared by all projects built with the same toolchain
+    std::map<String, int> getCheckResults(const String &toolchain_hash) const;
+    void setCheckResults(const String &toolchain_hash, const std::map<String, int> &results) const;
+    void clearCheckResults() const;
+
+    // check hash -> (check type, last duration in ms)
+    std::map<String, std::pair<int, int64_t>> getCheckDurations() const;
+    void setCheckDurations(const std::map<String, std::pair<int, int64_t>> &durations) const;
+
+    // cached until the compiler binary changes
+    String getCompilerFingerprint(const path &p, time_t mtime, uintmax_t size) const;
+    void setCompilerFingerprint(const path &p, time_t mtime, uintmax_t size, const String &fingerprint) const;
+
     Stamps getFileStamps() const;
-    void setFileStamps(const Stamps &stamps) const;
+    // writes only changed and removed stamps
+    void updateFileStamps(const Stamps &changed, const std::vector<path> &removed) const;
     void clearFileStamps() const;
+    // drops stamps of all files under the dir
+    void removeFileStamps(const path &dir) const;
 
 private:
     void createTables() const;
@@ -155,13 +199,36 @@ public:
     PackagesSet getTransitiveDependentPackages(const PackagesSet &pkgs);
 
     ProjectId getPackageId(const ProjectPath &ppath) const;
+    int getVersion() const;
 
 private:
+    // reverse dependency index: project id -> dependent project versions
+    struct DependentPackage
+    {
+        ProjectId project_id;
+        String ppath;
+        String version;
+    };
+    using ReverseDependencies = std::unordered_map<ProjectId, std::vector<DependentPackage>>;
+
     path db_repo_dir;
+    // import failed and the file was removed, it is loaded again by the next instance
+    bool unusable = false;
+    mutable std::unique_ptr<ReverseDependencies> reverse_dependencies;
+    // when available, queries are answered from it without sqlite
+    std::shared_ptr<const PackagesSnapshot> snapshot;
 
     void init();
     void download();
     void load(bool drop = false);
+    SqliteDatabase &getDb() const;
+
+    // table name -> csv contents
+    using TablesData = std::map<String, String>;
+    TablesData readTables() const;
+    // applies only changed rows, returns false when full load is required
+    bool update(const TablesData &old_tables);
+    void writeSnapshot() const;
 
     void writeDownloadTime() const;
     TimePoint readDownloadTime() const;
@@ -169,7 +236,9 @@ private:
     bool isCurrentDbOld() const;
 
     ProjectVersionId getExactProjectVersionId(const DownloadDependency &project, Version &version, ProjectFlags &flags, String &hash) const;
-    Dependencies getProjectDependencies(ProjectVersionId project_version_id, DependenciesMap &dm) const;
+    // fills dm with the whole dependency closure of the project version
+    void getProjectDependencies(ProjectVersionId project_version_id, DependenciesMap &dm) const;
+    const ReverseDependencies &getReverseDependencies() const;
 };
 
 ServiceDatabase &getServiceDatabase(bool init = true);
@@ -0,0 +1,49 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "database.h"
+
+class SqliteDatabase;
+
+extern TableDescriptors data_tables;
+extern std::vector<StartupAction> startup_actions;
+
+path getDbDirectory();
+
+// dependency closure of a project version, binds project version id
+// rows: parent id, version id (null when unresolved), project path, requested version,
+// project flags, dependency flags, major, minor, patch, branch, version flags, hash, created
+extern const String dependencies_closure_query;
+
+// rows that differ between two csv dumps of a table
+struct TableDelta
+{
+    const TableDescriptor *td;
+    int n_cols;
+    std::vector<int> pk; // primary key column indices
+    String delete_query;
+    String deleted;
+    String inserted;
+    size_t n_deleted = 0;
+    size_t n_inserted = 0;
+};
+
+// returns false when the table has no primary key
+bool get_table_delta(const SqliteDatabase &db, const TableDescriptor &td, const String &old_data, const String &new_data, TableDelta &d);
+// changed rows are deleted by key and inserted again, call it inside a transaction
+void apply_table_delta(const SqliteDatabase &db, TableDelta &d);
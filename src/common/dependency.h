@@ -43,6 +43,11 @@ public:
         id_dependencies = ids;
     }
 
+    const std::set<ProjectVersionId> &getDependencyIds() const
+    {
+        return id_dependencies;
+    }
+
     Dependencies getDependencies() const
     {
         return dependencies;
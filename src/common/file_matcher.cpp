@@ -0,0 +1,309 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "file_matcher.h"
+
+#include <boost/algorithm/string.hpp>
+
+#include <cctype>
+#include <cstring>
+
+namespace
+{
+
+bool is_meta(char c)
+{
+    return strchr(".[]()*+?{}^$|\\", c) != nullptr;
+}
+
+bool is_quantifier(char c)
+{
+    return c == '*' || c == '+' || c == '?' || c == '{';
+}
+
+// escaped punctuation is a literal char, escaped letters are classes (\d, \w, \b...)
+bool is_literal_escape(const String &s, size_t i)
+{
+    return s[i] == '\\' && i + 1 < s.size() && !isalnum((unsigned char)s[i + 1]);
+}
+
+// end of the bracket expression started at i, or npos
+size_t bracket_end(const String &s, size_t i)
+{
+    i++;
+    if (i < s.size() && s[i] == '^')
+        i++;
+    if (i < s.size() && s[i] == ']')
+        i++;
+    for (; i < s.size(); i++)
+    {
+        if (s[i] == '\\')
+            i++;
+        else if (s[i] == ']')
+            return i;
+    }
+    return String::npos;
+}
+
+bool has_top_level_alternation(const String &s)
+{
+    int depth = 0;
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        switch (s[i])
+        {
+        case '\\':
+            i++;
+            break;
+        case '[':
+        {
+            auto e = bracket_end(s, i);
+            if (e == String::npos)
+                return true;
+            i = e;
+            break;
+        }
+        case '(':
+            depth++;
+            break;
+        case ')':
+            depth--;
+            break;
+        case '|':
+            if (depth == 0)
+                return true;
+            break;
+        }
+    }
+    return false;
+}
+
+// reads a plain literal (no metachars) or returns false
+bool get_literal(const String &s, String &literal)
+{
+    literal.clear();
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        if (is_literal_escape(s, i))
+            literal += s[++i];
+        else if (is_meta(s[i]))
+            return false;
+        else
+            literal += s[i];
+    }
+    return true;
+}
+
+// true when the regex cannot match a string containing '/'
+bool is_slash_free(const String &s)
+{
+    for (size_t i = 0; i < s.size(); i++)
+    {
+        switch (s[i])
+        {
+        case '/':
+        case '.':
+            return false;
+        case '\\':
+            if (i + 1 >= s.size())
+                return false;
+            i++;
+            // \D, \W, \S match '/'
+            if (s[i] == '/' || isupper((unsigned char)s[i]))
+                return false;
+            break;
+        case '[':
+        {
+            auto e = bracket_end(s, i);
+            if (e == String::npos)
+                return false;
+            auto b = s.substr(i + 1, e - i - 1);
+            if (!b.empty() && b[0] == '^')
+            {
+                if (b.find('/') == String::npos)
+                    return false;
+            }
+            else
+            {
+                if (b.find('/') != String::npos || b.find('\\') != String::npos)
+                    return false;
+                // ranges like !-~
+                for (size_t j = 1; j + 1 < b.size(); j++)
+                {
+                    if (b[j] == '-' && b[j - 1] <= '/' && '/' <= b[j + 1])
+                        return false;
+                }
+            }
+            i = e;
+            break;
+        }
+        }
+    }
+    return true;
+}
+
+}
+
+bool FileMatcher::Pattern::match(const String &rel) const
+{
+    if (rel.compare(0, prefix.size(), prefix) != 0)
+        return false;
+    auto r = rel.c_str() + prefix.size();
+    auto n = rel.size() - prefix.size();
+    switch (type)
+    {
+    case Any:
+        return true;
+    case Literal:
+        return literal == r;
+    case Suffix:
+        if (n < literal.size() || literal.compare(0, String::npos, r + n - literal.size()) != 0)
+            return false;
+        return recursive || !memchr(r, '/', n);
+    }
+    return std::regex_match(r, r + n, rx);
+}
+
+FileMatcher::FileMatcher(const std::set<String> &in)
+{
+    for (auto &e : in)
+    {
+        auto p = std::make_unique<Pattern>();
+
+        // literal prefix ending with a path separator
+        size_t rem = 0;
+        if (!has_top_level_alternation(e))
+        {
+            String literal;
+            // end of each literal char in the pattern
+            std::vector<size_t> positions;
+            size_t i = 0;
+            for (; i < e.size(); i++)
+            {
+                if (is_literal_escape(e, i))
+                {
+                    literal += e[++i];
+                    positions.push_back(i + 1);
+                    continue;
+                }
+                if (is_meta(e[i]))
+                {
+                    // quantifier applies to the previous char
+                    if (is_quantifier(e[i]) && !literal.empty())
+                    {
+                        literal.pop_back();
+                        positions.pop_back();
+                    }
+                    break;
+                }
+                literal += e[i];
+                positions.push_back(i + 1);
+            }
+            auto slash = literal.rfind('/');
+            if (slash != String::npos)
+            {
+                p->prefix = literal.substr(0, slash + 1);
+                rem = positions[slash];
+            }
+        }
+
+        auto r = e.substr(rem);
+        String literal;
+        if (r == ".*")
+            p->type = Pattern::Any;
+        else if (get_literal(r, p->literal))
+        {
+            p->type = Pattern::Literal;
+            p->recursive = p->literal.find('/') != String::npos;
+        }
+        else if (boost::starts_with(r, ".*") && get_literal(r.substr(2), literal))
+        {
+            p->type = Pattern::Suffix;
+            p->literal = literal;
+        }
+        else if (boost::starts_with(r, "[^/]*") && get_literal(r.substr(5), literal) &&
+                 literal.find('/') == String::npos)
+        {
+            p->type = Pattern::Suffix;
+            p->literal = literal;
+            p->recursive = false;
+        }
+        else
+        {
+            p->rx = std::regex(r);
+            p->recursive = !is_slash_free(r);
+        }
+
+        auto n = &root;
+        Strings segments;
+        boost::split(segments, p->prefix, boost::is_any_of("/"));
+        // trailing '/' gives an empty last segment
+        segments.pop_back();
+        for (auto &s : segments)
+        {
+            auto &c = n->children[s];
+            if (!c)
+                c = std::make_unique<Node>();
+            n = c.get();
+        }
+        n->recursive |= p->recursive;
+        patterns.push_back(std::move(p));
+    }
+}
+
+bool FileMatcher::match(const String &rel) const
+{
+    for (auto &p : patterns)
+    {
+        if (p->match(rel))
+            return true;
+    }
+    return false;
+}
+
+bool FileMatcher::canEnter(const String &dir) const
+{
+    auto n = &root;
+    size_t b = 0;
+    while (!n->recursive)
+    {
+        auto e = dir.find('/', b);
+        auto i = n->children.find(dir.substr(b, e == String::npos ? e : e - b));
+        if (i == n->children.end())
+            return false;
+        n = i->second.get();
+        if (e == String::npos)
+            return true;
+        b = e + 1;
+    }
+    return true;
+}
+
+void FileMatcher::find(const path &root_dir, Files &files, const path &index_fn) const
+{
+    if (empty())
+        return;
+    auto filter = [this](const String &dir)
+    {
+        return canEnter(dir);
+    };
+    auto entries = index_fn.empty() ? walk_directory(root_dir, filter) : walk_directory(root_dir, index_fn, filter);
+    for (auto &e : entries)
+    {
+        if (match(e.rel))
+            files.insert(e.p);
+    }
+}
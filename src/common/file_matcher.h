@@ -0,0 +1,83 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "cppan_string.h"
+#include "filesystem.h"
+
+#include <map>
+#include <memory>
+#include <regex>
+#include <set>
+#include <vector>
+
+/// Matches paths relative to a project root against 'files' patterns
+/// (regexes, e.g. "src/.*", "include/.*\.h", "[^/]*\.cpp").
+/// Literal directory prefixes of the patterns are stored in a trie on path segments,
+/// so directories that cannot contain matches are never walked.
+/// Common remainders (".*", ".*\.ext", "[^/]*\.ext") are matched without std::regex.
+class FileMatcher
+{
+    struct Pattern
+    {
+        enum
+        {
+            Any,
+            Literal,
+            Suffix,
+            Regex,
+        };
+
+        // literal directory part, empty or ends with '/'
+        String prefix;
+        int type = Regex;
+        String literal;
+        std::regex rx;
+        // remainder may match paths with '/', so subdirs must be walked
+        bool recursive = true;
+
+        bool match(const String &rel) const;
+    };
+
+    struct Node
+    {
+        std::map<String, std::unique_ptr<Node>> children;
+        // some pattern with this prefix matches in subdirs
+        bool recursive = false;
+    };
+
+public:
+    FileMatcher(const std::set<String> &patterns);
+    FileMatcher(const FileMatcher &) = delete;
+    FileMatcher &operator=(const FileMatcher &) = delete;
+
+    bool empty() const { return patterns.empty(); }
+
+    // rel is a normalized path relative to the root
+    bool match(const String &rel) const;
+
+    // false when no file in the dir (relative, no trailing '/') can match
+    bool canEnter(const String &dir) const;
+
+    // recursively walks root and adds matched regular files
+    // with an index file only changed dirs are read
+    void find(const path &root, Files &files, const path &index_fn = path()) const;
+
+private:
+    std::vector<std::unique_ptr<Pattern>> patterns;
+    Node root;
+};
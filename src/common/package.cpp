@@ -16,6 +16,7 @@
 
 #include "dependency.h"
 
+#include "access_table.h"
 #include "config.h"
 #include "database.h"
 #include "directories.h"
@@ -245,21 +246,35 @@ void cleanPackage(const Package &pkg, int flags)
         }
     };
 
-    auto rm_recursive = [](const auto &pkg, const auto &files, const auto &ext)
+    // stamps of removed generated files must go too, otherwise they won't be rewritten
+    AccessTable at;
+
+    auto rm_recursive = [&at](const auto &pkg, const auto &files, const auto &ext)
     {
         boost::system::error_code ec;
         for (auto &f : files)
         {
             auto fn = f.filename().string();
             if (fn == pkg.target_name + ext)
+            {
                 fs::remove(f, ec);
+                at.remove(f);
+            }
         }
     };
 
     if (flags & CleanTarget::Src)
+    {
         rm(pkg.getDirSrc());
+        at.remove(pkg.getDirSrc());
+        getServiceDatabase().removeGeneratedPackage(pkg);
+    }
     if (flags & CleanTarget::Obj)
+    {
         rm(pkg.getDirObj() / "build"); // for object targets we remove subdir
+        at.remove(pkg.getDirObj());
+        getServiceDatabase().removeGeneratedPackage(pkg);
+    }
 
     if (flags & CleanTarget::Bin)
         remove_files_like(cache_dir_bin, ".*" + pkg.target_name + ".*");
@@ -28,6 +28,7 @@
 #include "settings.h"
 #include "shell_link.h"
 #include "sqlite_database.h"
+#include "stamp.h"
 
 #include <boost/algorithm/string.hpp>
 
@@ -135,21 +136,54 @@ void PackageStore::process(const path &p, Config &root)
         root.getDefaultProject().checks += cc.second.config->getDefaultProject().checks;
     }
 
+    // skip packages printed from the same inputs on previous runs
+    auto &sdb = getServiceDatabase();
+    auto generated = sdb.getGeneratedPackages();
+    auto hashes = get_generation_hashes();
+    std::map<String, String> printed;
+
     // make sure we have new printer every time
 
     // print deps
-    // do not multithread this! causes livelocks
+    Executor e(get_max_threads(8), "Printer thread");
+    e.throw_exceptions = true;
+    std::vector<std::shared_ptr<Printer>> printers;
     for (auto &cc : *this)
     {
         auto &d = cc.first;
-
-        auto printer = Printer::create(Settings::get_local_settings().printerType);
+        std::shared_ptr<Printer> printer = Printer::create(Settings::get_local_settings().printerType);
         printer->access_table = &access_table;
         printer->d = d;
         printer->cwd = d.getDirObj();
-        printer->print();
-        printer->print_meta();
+        if (!d.flags[pfLocalProject])
+        {
+            // empty hash means unknown inputs (no config or a cycle), such packages are always printed
+            // files may be removed by user or by cleaning
+            auto &h = hashes[d];
+            auto i = generated.find(d.target_name);
+            if (!rebuild_configs() && !h.empty() && i != generated.end() && i->second == h && printer->is_printed())
+                continue;
+            if (!h.empty())
+                printed[d.target_name] = h;
+        }
+        printers.push_back(printer);
+        e.push([printer]
+        {
+            printer->print();
+            printer->print_meta();
+        });
+    }
+    e.wait();
+
+    // printers do not write to the db, their results are stored here
+    std::map<Package, SourceGroups> sgs;
+    for (auto &printer : printers)
+    {
+        if (!printer->new_source_groups.empty())
+            sgs[printer->d] = std::move(printer->new_source_groups);
     }
+    sdb.setSourceGroups(sgs);
+    sdb.setGeneratedPackages(printed);
 
     ScopedCurrentPath cp(p);
 
@@ -161,6 +195,60 @@ void PackageStore::process(const path &p, Config &root)
     printer->print_meta();
 }
 
+std::map<Package, String> PackageStore::get_generation_hashes() const
+{
+    // things that are not in configs but go into generated files
+    auto &s = Settings::get_local_settings();
+    Hasher common;
+    common |= cppan_stamp;
+    common |= s.get_hash();
+    common |= normalize_path(directories.storage_dir);
+    common |= normalize_path(s.cppan_dir);
+    common |= normalize_path(s.output_dir);
+    common |= s.meta_target_suffix;
+    common |= s.install_prefix;
+    common |= std::to_string(s.build_warning_level);
+    common |= s.use_cache;
+    common |= s.show_ide_projects;
+    common |= s.add_run_cppan_target;
+    common |= s.build_system_verbose;
+    common |= s.copy_all_libraries_to_output;
+    common |= s.copy_import_libs;
+    common |= s.full_path_executables;
+    common |= s.rc_enabled;
+
+    // printers read dependencies' configs too, so their hashes are included
+    std::map<Package, String> hashes;
+    std::function<String(const Package &)> get_hash;
+    get_hash = [this, &hashes, &common, &get_hash](const Package &p)
+    {
+        auto i = hashes.find(p);
+        if (i != hashes.end())
+            return i->second;
+        hashes[p]; // break cycles
+
+        auto pc = packages.find(p);
+        if (pc == packages.end() || !pc->second.config)
+            return String();
+
+        Hasher h = common;
+        h |= p.target_name;
+        h |= p.flags.to_string();
+        h |= dump_yaml_config(pc->second.config->getDefaultProject().save());
+        for (auto &d : pc->second.dependencies)
+        {
+            h |= d.second.target_name;
+            h |= d.second.flags.to_string();
+            h |= get_hash(d.second);
+        }
+        return hashes[p] = h.hash;
+    };
+
+    for (auto &cc : *this)
+        get_hash(cc.first);
+    return hashes;
+}
+
 void PackageStore::resolve_dependencies(const Config &c)
 {
     if (c.getProjects().size() > 1)
@@ -187,7 +275,15 @@ void PackageStore::resolve_dependencies(const Config &c)
         if (i != resolved_packages.end())
         {
             // but still insert as a dependency
-            packages[c.pkg].dependencies.insert({ i->second.ppath.toString(), i->second });
+            // private and idir only flags come from this config, not from the one resolved it first
+            auto dep = d.second;
+            auto flags = i->second.flags;
+            flags.reset(pfPrivateDependency);
+            flags.reset(pfIncludeDirectoriesOnly);
+            dep.version = i->second.version;
+            dep.flags |= flags;
+            dep.createNames();
+            packages[c.pkg].dependencies.insert({ dep.ppath.toString(), dep });
             continue;
         }
 
@@ -205,6 +301,37 @@ void PackageStore::resolve_dependencies(const Config &c)
     check_deps_changed(); // goes after write_index()
 }
 
+bool PackageStore::resolve_dependencies(const std::vector<Config> &configs)
+{
+    // remote deps of all configs in one resolver pass
+    // the same package with different versions or flags is left for per config resolving
+    Packages deps;
+    std::set<String> conflicts;
+    for (auto &c : configs)
+    {
+        for (auto &d : c.getFileDependencies())
+        {
+            if (d.second.ppath.is_loc() || resolved_packages.find(d.second) != resolved_packages.end())
+                continue;
+            auto i = deps.find(d.first);
+            if (i == deps.end())
+                deps.insert(d);
+            else if (i->second.version != d.second.version || i->second.flags != d.second.flags)
+                conflicts.insert(d.first);
+        }
+    }
+    for (auto &c : conflicts)
+        deps.erase(c);
+
+    if (deps.empty())
+        return false;
+
+    // results go to resolved_packages, configs pick them up on add_local_config()
+    Resolver r;
+    r.resolve_dependencies(deps);
+    return true;
+}
+
 void PackageStore::check_deps_changed()
 {
     // already executed
@@ -490,8 +617,6 @@ PackageStore::read_packages_from_file(path p, const String &config_name, bool di
     std::set<Package> packages;
     auto configs = conf.split();
 
-    // batch resolve of deps first; merge flags?
-
     // seq
     for (auto &c : configs)
     {
@@ -562,6 +687,9 @@ PackageStore::read_packages_from_file(path p, const String &config_name, bool di
     }
     e.wait();
 
+    // batch resolve of remote deps
+    bool resolved = rd.resolve_dependencies(configs);
+
     // seq
     for (auto &c : configs)
     {
@@ -577,6 +705,8 @@ PackageStore::read_packages_from_file(path p, const String &config_name, bool di
     // write local packages to index
     // do not remove
     rd.write_index();
+    if (resolved)
+        rd.check_deps_changed(); // goes after write_index()
 
     return std::tuple<std::set<Package>, Config, String>{ packages, conf, sname };
 }
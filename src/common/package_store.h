@@ -79,6 +79,9 @@ private:
 
     void write_index() const;
     void check_deps_changed();
+    bool resolve_dependencies(const std::vector<Config> &configs);
+    // hash of everything printers use for every package
+    std::map<Package, String> get_generation_hashes() const;
 
     friend class Resolver;
 };
@@ -0,0 +1,490 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "packages_snapshot.h"
+
+#include "sqlite_database.h"
+
+#include <boost/algorithm/string.hpp>
+#include <boost/nowide/fstream.hpp>
+
+#include <cstring>
+#include <deque>
+#include <set>
+#include <string_view>
+#include <unordered_map>
+
+#define PACKAGES_SNAPSHOT_MAGIC "CPPANPDB"
+#define PACKAGES_SNAPSHOT_FORMAT 1
+
+struct PackagesSnapshot::StringRef
+{
+    uint32_t offset;
+    uint32_t size;
+};
+
+struct PackagesSnapshot::Header
+{
+    char magic[8];
+    uint32_t format;
+    int32_t db_version;
+    uint32_t n_projects;
+    uint32_t n_versions;
+    uint32_t n_dependencies;
+    uint32_t strings_size;
+};
+
+struct PackagesSnapshot::ProjectRecord
+{
+    uint64_t id;
+    uint64_t flags;
+    StringRef ppath;
+    int32_t type;
+    uint32_t versions_begin;
+    uint32_t versions_end;
+    uint32_t reserved;
+};
+
+struct PackagesSnapshot::VersionRecord
+{
+    uint64_t id;
+    uint64_t flags;
+    StringRef branch;
+    StringRef hash;
+    StringRef created;
+    int32_t version_major;
+    int32_t version_minor;
+    int32_t version_patch;
+    uint32_t project;
+    uint32_t dependencies_begin;
+    uint32_t dependencies_end;
+};
+
+struct PackagesSnapshot::DependencyRecord
+{
+    uint64_t flags;
+    StringRef version;
+    uint32_t project;
+    uint32_t reserved;
+};
+
+PackagesSnapshot::PackagesSnapshot(const path &fn, int db_version)
+{
+    static_assert(sizeof(Header) == 32, "bad snapshot header size");
+    static_assert(sizeof(ProjectRecord) == 40, "bad snapshot project record size");
+    static_assert(sizeof(VersionRecord) == 64, "bad snapshot version record size");
+    static_assert(sizeof(DependencyRecord) == 24, "bad snapshot dependency record size");
+
+    auto err = [&fn](const String &s)
+    {
+        return std::runtime_error("Bad packages snapshot " + fn.string() + ": " + s);
+    };
+
+    if (!fs::exists(fn))
+        throw err("file not found");
+
+    file = std::make_unique<MappedFile>(fn);
+    if (file->size() < sizeof(Header))
+        throw err("file is too small");
+
+    auto p = file->data();
+    header = (const Header *)p;
+    if (memcmp(header->magic, PACKAGES_SNAPSHOT_MAGIC, sizeof(header->magic)) != 0)
+        throw err("bad magic");
+    if (header->format != PACKAGES_SNAPSHOT_FORMAT)
+        throw err("unknown format");
+    if (header->db_version != db_version)
+        throw err("outdated");
+
+    size_t sz = sizeof(Header) +
+        header->n_projects * sizeof(ProjectRecord) +
+        header->n_versions * sizeof(VersionRecord) +
+        header->n_dependencies * sizeof(DependencyRecord) +
+        header->n_projects * sizeof(uint32_t) +
+        header->n_versions * sizeof(uint32_t) +
+        header->strings_size;
+    if (file->size() != sz)
+        throw err("bad size");
+
+    p += sizeof(Header);
+    projects = (const ProjectRecord *)p;
+    p += header->n_projects * sizeof(ProjectRecord);
+    versions = (const VersionRecord *)p;
+    p += header->n_versions * sizeof(VersionRecord);
+    dependencies = (const DependencyRecord *)p;
+    p += header->n_dependencies * sizeof(DependencyRecord);
+    projects_by_id = (const uint32_t *)p;
+    p += header->n_projects * sizeof(uint32_t);
+    versions_by_id = (const uint32_t *)p;
+    p += header->n_versions * sizeof(uint32_t);
+    strings = p;
+}
+
+PackagesSnapshot::~PackagesSnapshot()
+{
+}
+
+void PackagesSnapshot::write(const SqliteDatabase &db, const path &fn, int db_version)
+{
+    String strs;
+    auto add_string = [&strs](const char *s)
+    {
+        StringRef r{ (uint32_t)strs.size(), 0 };
+        if (s)
+        {
+            r.size = (uint32_t)strlen(s);
+            strs += s;
+        }
+        return r;
+    };
+
+    // projects
+    std::vector<ProjectRecord> prs;
+    std::unordered_map<uint64_t, uint32_t> project_idx;
+    db.execute("select id, path, type_id, flags from Projects order by path",
+        [&prs, &project_idx, &add_string](SQLITE_CALLBACK_ARGS)
+    {
+        ProjectRecord r{};
+        r.id = std::stoull(cols[0]);
+        r.ppath = add_string(cols[1]);
+        r.type = std::stoi(cols[2]);
+        r.flags = std::stoull(cols[3]);
+        project_idx[r.id] = (uint32_t)prs.size();
+        prs.push_back(r);
+        return 0;
+    });
+
+    // versions, grouped by project
+    std::vector<std::vector<VersionRecord>> pvrs(prs.size());
+    db.execute("select id, project_id, major, minor, patch, branch, flags, hash, created "
+        "from ProjectVersions order by branch, major, minor, patch",
+        [&pvrs, &project_idx, &add_string](SQLITE_CALLBACK_ARGS)
+    {
+        auto i = project_idx.find(std::stoull(cols[1]));
+        if (i == project_idx.end())
+            return 0;
+        VersionRecord r{};
+        r.id = std::stoull(cols[0]);
+        r.version_major = cols[2] ? std::stoi(cols[2]) : -1;
+        r.version_minor = cols[3] ? std::stoi(cols[3]) : -1;
+        r.version_patch = cols[4] ? std::stoi(cols[4]) : -1;
+        r.branch = add_string(cols[5]);
+        r.flags = std::stoull(cols[6]);
+        r.hash = add_string(cols[7]);
+        r.created = add_string(cols[8]);
+        r.project = i->second;
+        pvrs[i->second].push_back(r);
+        return 0;
+    });
+
+    std::vector<VersionRecord> vrs;
+    std::unordered_map<uint64_t, uint32_t> version_idx;
+    for (size_t i = 0; i < prs.size(); i++)
+    {
+        prs[i].versions_begin = (uint32_t)vrs.size();
+        for (auto &v : pvrs[i])
+        {
+            version_idx[v.id] = (uint32_t)vrs.size();
+            vrs.push_back(v);
+        }
+        prs[i].versions_end = (uint32_t)vrs.size();
+    }
+
+    // dependencies, grouped by version
+    std::vector<std::vector<DependencyRecord>> vdrs(vrs.size());
+    db.execute("select project_version_id, project_dependency_id, version, ProjectVersionDependencies.flags "
+        "from ProjectVersionDependencies join Projects on Projects.id = project_dependency_id order by path",
+        [&vdrs, &project_idx, &version_idx, &add_string](SQLITE_CALLBACK_ARGS)
+    {
+        auto v = version_idx.find(std::stoull(cols[0]));
+        auto p = project_idx.find(std::stoull(cols[1]));
+        if (v == version_idx.end() || p == project_idx.end())
+            return 0;
+        DependencyRecord r{};
+        r.project = p->second;
+        r.version = add_string(cols[2]);
+        r.flags = std::stoull(cols[3]);
+        vdrs[v->second].push_back(r);
+        return 0;
+    });
+
+    std::vector<DependencyRecord> drs;
+    for (size_t i = 0; i < vrs.size(); i++)
+    {
+        vrs[i].dependencies_begin = (uint32_t)drs.size();
+        drs.insert(drs.end(), vdrs[i].begin(), vdrs[i].end());
+        vrs[i].dependencies_end = (uint32_t)drs.size();
+    }
+
+    // id indexes
+    std::vector<uint32_t> pids(prs.size()), vids(vrs.size());
+    for (uint32_t i = 0; i < pids.size(); i++)
+        pids[i] = i;
+    for (uint32_t i = 0; i < vids.size(); i++)
+        vids[i] = i;
+    std::sort(pids.begin(), pids.end(), [&prs](auto a, auto b) { return prs[a].id < prs[b].id; });
+    std::sort(vids.begin(), vids.end(), [&vrs](auto a, auto b) { return vrs[a].id < vrs[b].id; });
+
+    Header h{};
+    memcpy(h.magic, PACKAGES_SNAPSHOT_MAGIC, sizeof(h.magic));
+    h.format = PACKAGES_SNAPSHOT_FORMAT;
+    h.db_version = db_version;
+    h.n_projects = (uint32_t)prs.size();
+    h.n_versions = (uint32_t)vrs.size();
+    h.n_dependencies = (uint32_t)drs.size();
+    h.strings_size = (uint32_t)strs.size();
+
+    // write to temp file first, so readers never see partial file
+    auto tmp = fn.parent_path() / (fn.filename().string() + ".tmp");
+    {
+        boost::nowide::ofstream o(tmp.string(), std::ios::binary | std::ios::out);
+        if (!o)
+            throw std::runtime_error("Cannot open file for writing: " + tmp.string());
+        auto write = [&o](const auto &v)
+        {
+            if (!v.empty())
+                o.write((const char *)v.data(), v.size() * sizeof(v[0]));
+        };
+        o.write((const char *)&h, sizeof(h));
+        write(prs);
+        write(vrs);
+        write(drs);
+        write(pids);
+        write(vids);
+        write(strs);
+        if (!o)
+            throw std::runtime_error("Cannot write file: " + tmp.string());
+    }
+    // a file of the same version has the same data and may be mapped by other processes
+    // (it cannot be replaced on windows then), so keep it
+    boost::system::error_code ec;
+    fs::rename(tmp, fn, ec);
+    if (ec)
+    {
+        fs::remove(tmp, ec);
+        if (!fs::exists(fn))
+            throw std::runtime_error("Cannot rename " + tmp.string() + " to " + fn.string());
+    }
+}
+
+String PackagesSnapshot::getString(const StringRef &s) const
+{
+    return String(strings + s.offset, s.size);
+}
+
+const PackagesSnapshot::ProjectRecord *PackagesSnapshot::findProject(const String &ppath) const
+{
+    auto e = projects + header->n_projects;
+    auto i = std::lower_bound(projects, e, ppath, [this](const auto &p, const auto &s)
+    {
+        return std::string_view(strings + p.ppath.offset, p.ppath.size) < s;
+    });
+    if (i == e || std::string_view(strings + i->ppath.offset, i->ppath.size) != ppath)
+        return nullptr;
+    return i;
+}
+
+const PackagesSnapshot::ProjectRecord *PackagesSnapshot::findProjectById(ProjectId id) const
+{
+    auto e = projects_by_id + header->n_projects;
+    auto i = std::lower_bound(projects_by_id, e, id, [this](auto p, auto id)
+    {
+        return projects[p].id < id;
+    });
+    if (i == e || projects[*i].id != id)
+        return nullptr;
+    return &projects[*i];
+}
+
+const PackagesSnapshot::VersionRecord *PackagesSnapshot::findVersionById(ProjectVersionId id) const
+{
+    auto e = versions_by_id + header->n_versions;
+    auto i = std::lower_bound(versions_by_id, e, id, [this](auto v, auto id)
+    {
+        return versions[v].id < id;
+    });
+    if (i == e || versions[*i].id != id)
+        return nullptr;
+    return &versions[*i];
+}
+
+PackagesSnapshot::Project PackagesSnapshot::makeProject(const ProjectRecord &r) const
+{
+    Project p;
+    p.id = r.id;
+    p.type = (ProjectType)r.type;
+    p.flags = r.flags;
+    p.ppath = getString(r.ppath);
+    return p;
+}
+
+PackagesSnapshot::ProjectVersion PackagesSnapshot::makeVersion(const VersionRecord &r) const
+{
+    ProjectVersion v;
+    v.id = r.id;
+    if (r.branch.size)
+        v.version = getString(r.branch);
+    else
+    {
+        v.version = Version(r.version_major, r.version_minor, r.version_patch);
+        v.version.type = VersionType::Version;
+    }
+    v.flags = r.flags;
+    v.hash = getString(r.hash);
+    v.created = getString(r.created);
+    return v;
+}
+
+const PackagesSnapshot::VersionRecord *PackagesSnapshot::selectVersion(const ProjectRecord &p, const Version &spec) const
+{
+    // same rules as PackagesDatabase::getExactProjectVersionId()
+    const VersionRecord *best = nullptr;
+    for (auto i = p.versions_begin; i < p.versions_end; i++)
+    {
+        auto &v = versions[i];
+        if (spec.isBranch())
+        {
+            if (std::string_view(strings + v.branch.offset, v.branch.size) == spec.branch)
+                return &v;
+            continue;
+        }
+        if (v.branch.size)
+            continue;
+        if (spec.major != -1 && spec.major != v.version_major ||
+            spec.minor != -1 && spec.minor != v.version_minor ||
+            spec.patch != -1 && spec.patch != v.version_patch)
+            continue;
+        if (!best ||
+            std::tie(best->version_major, best->version_minor, best->version_patch) <
+            std::tie(v.version_major, v.version_minor, v.version_patch))
+            best = &v;
+    }
+    return best;
+}
+
+bool PackagesSnapshot::getProject(const ProjectPath &ppath, Project &p) const
+{
+    auto r = findProject(ppath.toString());
+    if (!r)
+        return false;
+    p = makeProject(*r);
+    return true;
+}
+
+std::vector<PackagesSnapshot::Project> PackagesSnapshot::getChildProjects(const ProjectPath &ppath) const
+{
+    std::vector<Project> r;
+    auto prefix = ppath.toString() + ".";
+    auto e = projects + header->n_projects;
+    auto i = std::lower_bound(projects, e, prefix, [this](const auto &p, const auto &s)
+    {
+        return std::string_view(strings + p.ppath.offset, p.ppath.size) < s;
+    });
+    for (; i != e; ++i)
+    {
+        if (std::string_view(strings + i->ppath.offset, i->ppath.size).compare(0, prefix.size(), prefix) != 0)
+            break;
+        auto t = (ProjectType)i->type;
+        if (t == ProjectType::Library || t == ProjectType::Executable)
+            r.push_back(makeProject(*i));
+    }
+    return r;
+}
+
+bool PackagesSnapshot::selectVersion(ProjectId project_id, const Version &spec, ProjectVersion &v) const
+{
+    auto p = findProjectById(project_id);
+    if (!p)
+        return false;
+    auto r = selectVersion(*p, spec);
+    if (!r)
+        return false;
+    v = makeVersion(*r);
+    return true;
+}
+
+std::vector<PackagesSnapshot::Dependency> PackagesSnapshot::getDependencies(ProjectVersionId project_version_id) const
+{
+    std::vector<Dependency> deps;
+    auto root = findVersionById(project_version_id);
+    if (!root)
+        return deps;
+
+    std::set<const VersionRecord *> visited{ root };
+    std::deque<const VersionRecord *> q{ root };
+    while (!q.empty())
+    {
+        auto v = q.front();
+        q.pop_front();
+        for (auto i = v->dependencies_begin; i < v->dependencies_end; i++)
+        {
+            auto &dr = dependencies[i];
+            auto &pr = projects[dr.project];
+
+            Dependency d;
+            d.parent = v->id;
+            d.project = makeProject(pr);
+            d.version = getString(dr.version);
+            d.flags = dr.flags;
+
+            const VersionRecord *sv = nullptr;
+            try
+            {
+                sv = selectVersion(pr, d.version);
+            }
+            catch (std::exception &)
+            {
+                // bad version spec, edge is unresolved
+            }
+            if (sv)
+            {
+                d.resolved = true;
+                d.selected = makeVersion(*sv);
+                if (visited.insert(sv).second)
+                    q.push_back(sv);
+            }
+            deps.push_back(d);
+        }
+    }
+    return deps;
+}
+
+std::vector<ProjectPath> PackagesSnapshot::getMatchingPackages(const String &name) const
+{
+    std::vector<ProjectPath> pkgs;
+    for (uint32_t i = 0; i < header->n_projects; i++)
+    {
+        auto &p = projects[i];
+        if ((ProjectType)p.type == ProjectType::RootProject)
+            continue;
+        auto s = getString(p.ppath);
+        // sql 'like' is case insensitive
+        if (name.empty() || boost::icontains(s, name))
+            pkgs.push_back(s);
+    }
+    return pkgs;
+}
+
+std::vector<Version> PackagesSnapshot::getVersionsForPackage(const ProjectPath &ppath) const
+{
+    std::vector<Version> vs;
+    auto p = findProject(ppath.toString());
+    if (!p)
+        return vs;
+    for (auto i = p->versions_begin; i < p->versions_end; i++)
+        vs.push_back(makeVersion(versions[i]).version);
+    return vs;
+}
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2016-2017, Egor Pugin
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include "cppan_string.h"
+#include "dependency.h"
+#include "enums.h"
+#include "filesystem.h"
+
+#include <memory>
+#include <vector>
+
+class SqliteDatabase;
+
+/// Compact read only copy of the packages database.
+/// Layout: header, projects (sorted by path), project versions
+/// (grouped by project), dependencies (grouped by version), id indexes, strings.
+/// The file is memory mapped, so opening it is almost free.
+class PackagesSnapshot
+{
+public:
+    struct Project
+    {
+        ProjectId id = 0;
+        ProjectType type = ProjectType::None;
+        ProjectFlags flags;
+        ProjectPath ppath;
+    };
+
+    struct ProjectVersion
+    {
+        ProjectVersionId id = 0;
+        Version version;
+        ProjectFlags flags;
+        String hash;
+        String created;
+    };
+
+    struct Dependency
+    {
+        ProjectVersionId parent = 0;
+        Project project;
+        String version; // version spec
+        ProjectFlags flags;
+        bool resolved = false;
+        ProjectVersion selected;
+    };
+
+public:
+    // throws on missing, corrupted or outdated file
+    PackagesSnapshot(const path &fn, int db_version);
+    ~PackagesSnapshot();
+
+    static void write(const SqliteDatabase &db, const path &fn, int db_version);
+
+    bool getProject(const ProjectPath &ppath, Project &p) const;
+    std::vector<Project> getChildProjects(const ProjectPath &ppath) const;
+    bool selectVersion(ProjectId project_id, const Version &spec, ProjectVersion &v) const;
+    // whole transitive closure, unresolved edges are returned with resolved = false
+    std::vector<Dependency> getDependencies(ProjectVersionId project_version_id) const;
+
+    std::vector<ProjectPath> getMatchingPackages(const String &name = String()) const;
+    std::vector<Version> getVersionsForPackage(const ProjectPath &ppath) const;
+
+private:
+    struct StringRef;
+    struct Header;
+    struct ProjectRecord;
+    struct VersionRecord;
+    struct DependencyRecord;
+
+    std::unique_ptr<MappedFile> file;
+    const Header *header = nullptr;
+    const ProjectRecord *projects = nullptr;
+    const VersionRecord *versions = nullptr;
+    const DependencyRecord *dependencies = nullptr;
+    const uint32_t *projects_by_id = nullptr;
+    const uint32_t *versions_by_id = nullptr;
+    const char *strings = nullptr;
+
+    String getString(const StringRef &s) const;
+    const ProjectRecord *findProject(const String &ppath) const;
+    const ProjectRecord *findProjectById(ProjectId id) const;
+    const VersionRecord *findVersionById(ProjectVersionId id) const;
+    const VersionRecord *selectVersion(const ProjectRecord &p, const Version &spec) const;
+    Project makeProject(const ProjectRecord &p) const;
+    ProjectVersion makeVersion(const VersionRecord &v) const;
+};
@@ -19,6 +19,9 @@
 #include "bazel/bazel.h"
 #include "checks_detail.h"
 #include "config.h"
+#include "directories.h"
+#include "file_matcher.h"
+#include "hash.h"
 #include "http.h"
 #include "resolver.h"
 
@@ -602,54 +605,32 @@ void Project::findSources(path p)
     if ((sources.empty() && files.empty()) && !empty)
         throw std::runtime_error("'files' must be populated");
 
-    auto create_regex = [&p](const auto &e)
+    FileMatcher m(sources);
+    path index_fn;
+    if (pkg.flags[pfLocalProject])
     {
-        auto s = normalize_path(p);
-        s = escape_regex_symbols(s);
-        if (!s.empty() && s.back() != '/')
-            s += "/";
-        return std::regex(s + e);
-    };
-
-    std::map<String, std::regex> rgxs, rgxs_exclude;
-
-    for (auto &e : sources)
-        rgxs[e] = create_regex(e);
-    if (!rgxs.empty())
-    {
-        for (auto &f : boost::make_iterator_range(fs::recursive_directory_iterator(p), {}))
-        {
-            if (!fs::is_regular_file(f))
-                continue;
-
-            auto s = normalize_path(f);
-            for (auto &e : rgxs)
-            {
-                if (!std::regex_match(s, e.second))
-                    continue;
-                files.insert(f);
-                break;
-            }
-        }
+        // local trees are walked on every run, keep their listing between runs
+        String key = normalize_path(fs::absolute(p));
+        for (auto &e : sources)
+            key += "\n" + e;
+        index_fn = directories.storage_dir_etc / "index" / sha256(key);
     }
+    m.find(p, files, index_fn);
 
-    for (auto &e : exclude_from_package)
-        rgxs_exclude[e] = create_regex(e);
-    if (!rgxs_exclude.empty())
+    FileMatcher me(exclude_from_package);
+    if (!me.empty())
     {
-        auto to_remove = files;
-        for (auto &f : files)
+        auto root = normalize_path(p);
+        if (!root.empty() && root.back() != '/')
+            root += "/";
+        for (auto i = files.begin(); i != files.end();)
         {
-            auto s = normalize_path(f);
-            for (auto &e : rgxs_exclude)
-            {
-                if (!std::regex_match(s, e.second))
-                    continue;
-                to_remove.erase(f);
-                break;
-            }
+            auto s = normalize_path(*i);
+            if (s.compare(0, root.size(), root) == 0 && me.match(s.substr(root.size())))
+                i = files.erase(i);
+            else
+                ++i;
         }
-        files = to_remove;
     }
 
     if (files.empty() && !empty)
@@ -1492,11 +1473,11 @@ const Files &Project::getSources() const
 {
     if (!files.empty())
         return files;
-    for (auto &f : boost::make_iterator_range(fs::recursive_directory_iterator(pkg.getDirSrc()), {}))
+    for (auto &f : walk_directory(pkg.getDirSrc()))
     {
-        if (!fs::is_regular_file(f) || f.path().filename() == CPPAN_FILENAME)
+        if (f.p.filename() == CPPAN_FILENAME)
             continue;
-        files.insert(f);
+        files.insert(f.p);
     }
     return files;
 }
@@ -284,6 +284,8 @@ public:
     bool writeArchive(const path &fn) const;
     void prepareExports() const;
     void patchSources() const;
+    // files of a downloaded package are listed on the first call
+    const Files &getSources() const;
 
     void setRelativePath(const String &name);
 
@@ -304,7 +306,6 @@ public:
 private:
     ProjectPath root_project;
 
-    const Files &getSources() const;
     ProjectPath relative_name_to_absolute(const String &name);
     std::optional<ProjectPath> load_local_dependency(const String &name);
 };
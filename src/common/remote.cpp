@@ -16,6 +16,7 @@
 
 #include "remote.h"
 
+#include "archive_cache.h"
 #include "hash.h"
 #include "package.h"
 
@@ -41,6 +42,10 @@ Remotes get_default_remotes()
 
 bool Remote::downloadPackage(const Package &d, const String &hash, const path &fn, bool try_only_first) const
 {
+    auto &cache = getArchiveCache();
+    if (cache.get(hash, fn))
+        return true;
+
     auto download_from_source = [&](const auto &s)
     {
         try
@@ -51,7 +56,10 @@ bool Remote::downloadPackage(const Package &d, const String &hash, const path &f
         {
             return false;
         }
-        return check_file_hash(fn, hash);
+        if (!check_file_hash(fn, hash))
+            return false;
+        cache.add(hash, fn);
+        return true;
     };
 
     for (auto &s : primary_sources)
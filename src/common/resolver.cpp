@@ -17,6 +17,7 @@
 #include "resolver.h"
 
 #include "access_table.h"
+#include "archive_cache.h"
 #include "config.h"
 #include "database.h"
 #include "directories.h"
@@ -29,6 +30,11 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <condition_variable>
+#include <limits>
+#include <mutex>
+#include <thread>
+
 #include <primitives/executor.h>
 #include <primitives/hash.h>
 #include <primitives/hasher.h>
@@ -43,8 +49,43 @@ DECLARE_STATIC_LOGGER(logger, "resolver");
 TYPED_EXCEPTION(LocalDbHashException);
 TYPED_EXCEPTION(DependencyNotResolved);
 
-Resolver::Dependencies getDependenciesFromRemote(const Packages &deps, const Remote *current_remote);
-Resolver::Dependencies getDependenciesFromDb(const Packages &deps, const Remote *current_remote);
+// do not open too many connections to a single server
+const int max_connections_per_remote = 4;
+
+class ConnectionLimiter
+{
+public:
+    ConnectionLimiter(int n)
+        : n(n)
+    {
+    }
+
+    void acquire(const Remote *r)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        cv.wait(lk, [this, r] { return active[r] < n; });
+        active[r]++;
+    }
+
+    void release(const Remote *r)
+    {
+        {
+            std::unique_lock<std::mutex> lk(m);
+            active[r]--;
+        }
+        cv.notify_all();
+    }
+
+private:
+    int n;
+    std::map<const Remote *, int> active;
+    std::mutex m;
+    std::condition_variable cv;
+};
+
+IdDependencies getDependenciesFromRemote(const Packages &deps, const Remote *current_remote);
+IdDependencies getDependenciesFromDb(const Packages &deps);
+String getDependenciesHash(const Packages &deps, const Remote *current_remote);
 Resolver::Dependencies prepareIdDependencies(const IdDependencies &id_deps, const Remote *current_remote);
 
 PackagesMap resolve_dependencies(const Packages &deps)
@@ -135,7 +176,8 @@ void Resolver::resolve(const Packages &deps, std::function<void()> resolve_actio
     auto cr = us.remotes.begin();
     current_remote = &*cr++;
 
-    auto resolve_remote_deps = [this, &deps, &cr, &us]()
+    IdDependencies id_deps;
+    auto resolve_remote_deps = [this, &deps, &cr, &us, &id_deps]()
     {
         bool again = true;
         while (again)
@@ -145,7 +187,7 @@ void Resolver::resolve(const Packages &deps, std::function<void()> resolve_actio
             {
                 if (us.remotes.size() > 1)
                     LOG_INFO(logger, "Trying " + current_remote->name + " remote");
-                download_dependencies_ = getDependenciesFromRemote(deps, current_remote);
+                id_deps = getDependenciesFromRemote(deps, current_remote);
             }
             catch (const std::exception &e)
             {
@@ -162,6 +204,35 @@ void Resolver::resolve(const Packages &deps, std::function<void()> resolve_actio
     };
 
     query_local_db = !us.force_server_query;
+
+    // same request against the same packages db gives the same result,
+    // so reuse the previous resolution when we have one
+    const auto first_remote = current_remote;
+    String deps_hash;
+    int packages_db_version = 0;
+    if (query_local_db)
+    {
+        auto &sdb = getServiceDatabase();
+        deps_hash = getDependenciesHash(deps, current_remote);
+        packages_db_version = getPackagesDatabase().getVersion();
+        if (sdb.getResolvedDependencies(deps_hash, packages_db_version, id_deps))
+        {
+            try
+            {
+                download_dependencies_ = prepareIdDependencies(id_deps, current_remote);
+                resolve_action();
+                return;
+            }
+            catch (LocalDbHashException &)
+            {
+                // hashes are stalled, resolve again
+                LOG_DEBUG(logger, "Cached dependencies caused issues, resolving again");
+                sdb.removeResolvedDependencies(deps_hash);
+                id_deps.clear();
+            }
+        }
+    }
+
     // do 2 attempts: 1) local db, 2) remote db
     int n_attempts = query_local_db ? 2 : 1;
     while (n_attempts--)
@@ -172,7 +243,7 @@ void Resolver::resolve(const Packages &deps, std::function<void()> resolve_actio
             {
                 try
                 {
-                    download_dependencies_ = getDependenciesFromDb(deps, current_remote);
+                    id_deps = getDependenciesFromDb(deps);
                 }
                 catch (std::exception &e)
                 {
@@ -187,6 +258,7 @@ void Resolver::resolve(const Packages &deps, std::function<void()> resolve_actio
                 resolve_remote_deps();
             }
 
+            download_dependencies_ = prepareIdDependencies(id_deps, current_remote);
             resolve_action();
         }
         catch (LocalDbHashException &)
@@ -198,6 +270,9 @@ void Resolver::resolve(const Packages &deps, std::function<void()> resolve_actio
         }
         break;
     }
+
+    if (!deps_hash.empty() && current_remote == first_remote)
+        getServiceDatabase().setResolvedDependencies(deps_hash, packages_db_version, id_deps);
 }
 
 void Resolver::download(const DownloadDependency &d, const path &fn)
@@ -219,59 +294,57 @@ void Resolver::download_and_unpack()
     if (download_dependencies_.empty())
         return;
 
-    auto download_dependency = [this](auto &dd)
+    // one package download, passed from download to unpack stage
+    struct DownloadTask
     {
-        auto &d = dd.second;
-        auto version_dir = d.getDirSrc();
-        auto hash_file = d.getStampFilename();
-        bool must_download = d.getStampHash() != d.hash || d.hash.empty();
-
-        if (fs::exists(version_dir) && !must_download)
-            return;
-
-        // lock, so only one cppan process at the time could download the project
-        ScopedFileLock lck(hash_file, std::defer_lock);
-        if (!lck.try_lock())
+        DownloadDependency *d = nullptr;
+        uintmax_t size = 0; // archive size from the previous download
+        std::unique_ptr<ScopedFileLock> lock;
+        path staging_dir;
+        path fn;
+        std::chrono::milliseconds download_time{ 0 };
+
+        ~DownloadTask()
         {
-            // download is in progress, wait and register config
-            ScopedFileLock lck2(hash_file);
-            rd.add_config(d);
-            return;
+            boost::system::error_code ec;
+            if (!fn.empty())
+                fs::remove(fn, ec);
+            if (!staging_dir.empty())
+                fs::remove_all(staging_dir, ec);
         }
+    };
+    using DownloadTaskPtr = std::shared_ptr<DownloadTask>;
 
-        // Do this before we clean previous package version!
-        // This is useful when we have network issues during download,
-        // so we won't lost existing package.
-        LOG_INFO(logger, "Downloading: " << d.target_name << "...");
-
-        // maybe d.target_name instead of version_dir.string()?
-        path fn = make_archive_name((temp_directory_path("dl") / d.target_name).string());
-        download(d, fn);
-
-        // verify before cleaning old pkg
-        if (Settings::get_local_settings().verify_all)
-            verify(d, fn);
-
-        // remove existing version dir
-        cleanPackages(d.target_name);
+    // unpackers run on several threads, so the rows are written after them
+    std::vector<PackageDownloadTimes> download_times;
+    std::mutex download_times_mutex;
 
-        rd.downloads++;
-        write_file(hash_file, d.hash);
+    auto unpack_package = [this, &download_times, &download_times_mutex](DownloadTask &t)
+    {
+        auto &d = *t.d;
+        auto version_dir = d.getDirSrc();
+        auto size = fs::file_size(t.fn);
+        auto start = Clock::now();
 
         LOG_INFO(logger, "Unpacking  : " << d.target_name << "...");
-        Files files;
         try
         {
-            files = unpack_file(fn, version_dir);
+            unpack_file(t.fn, t.staging_dir);
         }
         catch (std::exception &e)
         {
             LOG_ERROR(logger, e.what());
-            fs::remove(fn);
-            fs::remove_all(version_dir);
             throw;
         }
-        fs::remove(fn);
+        fs::remove(t.fn);
+
+        // remove existing version dir and commit the new one
+        cleanPackages(d.target_name);
+        fs::remove_all(version_dir);
+        fs::rename(t.staging_dir, version_dir);
+
+        rd.downloads++;
+        write_file(d.getStampFilename(), d.hash);
 
         // re-read in any case
         // no need to remove old config, let it die with program
@@ -301,8 +374,86 @@ void Resolver::download_and_unpack()
                 }
             }
         }
+
+        auto unpack_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+        LOG_DEBUG(logger, d.target_name << ": " << size << " bytes, download " << t.download_time.count() << " ms, unpack " << unpack_time.count() << " ms");
+        std::lock_guard<std::mutex> lk(download_times_mutex);
+        download_times.push_back({ d.ppath.toString(), size, t.download_time.count(), unpack_time.count() });
+    };
+
+    // unpacking is cpu bound, so it runs on its own threads
+    // and does not hold network slots
+    Executor eu(std::max(1u, std::thread::hardware_concurrency()), "Unpack thread");
+    eu.throw_exceptions = true;
+
+    ConnectionLimiter limiter(max_connections_per_remote);
+
+    auto download_package = [this, &unpack_package, &eu, &limiter](const DownloadTaskPtr &t)
+    {
+        auto &d = *t->d;
+        auto version_dir = d.getDirSrc();
+        auto hash_file = d.getStampFilename();
+        bool must_download = d.getStampHash() != d.hash || d.hash.empty();
+
+        if (fs::exists(version_dir) && !must_download)
+            return;
+
+        // lock, so only one cppan process at the time could download the project
+        t->lock = std::make_unique<ScopedFileLock>(hash_file, std::defer_lock);
+        if (!t->lock->try_lock())
+        {
+            // download is in progress, wait and register config
+            t->lock.reset();
+            ScopedFileLock lck2(hash_file);
+            rd.add_config(d);
+            return;
+        }
+
+        // Do this before we clean previous package version!
+        // This is useful when we have network issues during download,
+        // so we won't lost existing package.
+        limiter.acquire(d.remote);
+        SCOPE_EXIT
+        {
+            limiter.release(d.remote);
+        };
+        LOG_INFO(logger, "Downloading: " << d.target_name << "...");
+
+        // download and unpack next to the package dir,
+        // so the old version stays usable until the new one is complete
+        // and the commit is a simple rename on the same filesystem
+        t->staging_dir = version_dir.parent_path() / (version_dir.filename().string() + ".tmp");
+        t->fn = make_archive_name(t->staging_dir.string());
+        fs::remove_all(t->staging_dir);
+
+        auto start = Clock::now();
+        download(d, t->fn);
+        t->download_time = std::chrono::duration_cast<std::chrono::milliseconds>(Clock::now() - start);
+
+        // verify before cleaning old pkg
+        if (Settings::get_local_settings().verify_all)
+            verify(d, t->fn);
+
+        eu.push([t, &unpack_package] { unpack_package(*t); });
     };
 
+    // start from the largest archives, so they do not end up in the tail;
+    // packages never downloaded before go first, their size is unknown
+    auto sizes = getServiceDatabase().getPackageArchiveSizes();
+    std::vector<DownloadTaskPtr> tasks;
+    for (auto &dd : download_dependencies_)
+    {
+        auto t = std::make_shared<DownloadTask>();
+        t->d = &dd.second;
+        auto i = sizes.find(dd.second.ppath.toString());
+        t->size = i == sizes.end() ? std::numeric_limits<uintmax_t>::max() : i->second;
+        tasks.push_back(t);
+    }
+    std::stable_sort(tasks.begin(), tasks.end(), [](const auto &t1, const auto &t2)
+    {
+        return t1->size > t2->size;
+    });
+
     Executor e(get_max_threads(8), "Download thread");
     e.throw_exceptions = true;
 
@@ -310,10 +461,51 @@ void Resolver::download_and_unpack()
     // so current path is not correctly restored
     ScopedCurrentPath cp;
 
-    for (auto &dd : download_dependencies_)
-        e.push([&download_dependency, &dd] { download_dependency(dd); });
+    auto downloads = rd.downloads;
+    for (auto &t : tasks)
+        e.push([&download_package, t] { download_package(t); });
+    tasks.clear();
 
-    e.wait();
+    // always wait for unpackers, they use this frame
+    std::exception_ptr eptr;
+    try
+    {
+        e.wait();
+    }
+    catch (...)
+    {
+        eptr = std::current_exception();
+    }
+    try
+    {
+        eu.wait();
+    }
+    catch (...)
+    {
+        if (!eptr)
+            eptr = std::current_exception();
+    }
+    // timings of the completed downloads are useful even after errors
+    getServiceDatabase().addPackageDownloads(download_times);
+    if (eptr)
+        std::rethrow_exception(eptr);
+
+    // new archives were added to the cache
+    if (rd.downloads != downloads)
+    {
+        e.push([]
+        {
+            try
+            {
+                auto &us = Settings::get_user_settings();
+                getArchiveCache().gc(uintmax_t(us.archive_cache_size) * 1024 * 1024);
+            }
+            catch (std::exception &e)
+            {
+                LOG_WARN(logger, "Cannot cleanup archive cache: " << e.what());
+            }
+        });
+    }
 
     // two following blocks use executor to do parallel queries
     if (query_local_db)
@@ -524,7 +716,7 @@ void Resolver::assign_dependencies(const Package &pkg, const Packages &deps)
     }
 }
 
-Resolver::Dependencies getDependenciesFromRemote(const Packages &deps, const Remote *current_remote)
+IdDependencies getDependenciesFromRemote(const Packages &deps, const Remote *current_remote)
 {
     // prepare request
     ptree request;
@@ -653,14 +845,21 @@ Resolver::Dependencies getDependenciesFromRemote(const Packages &deps, const Rem
         throw std::runtime_error("Some packages (" + std::to_string(d2.size()) + ") are unresolved");
     }
 
-    return prepareIdDependencies(id_deps, current_remote);
+    return id_deps;
 }
 
-Resolver::Dependencies getDependenciesFromDb(const Packages &deps, const Remote *current_remote)
+IdDependencies getDependenciesFromDb(const Packages &deps)
 {
     auto &db = getPackagesDatabase();
-    auto id_deps = db.findDependencies(deps);
-    return prepareIdDependencies(id_deps, current_remote);
+    return db.findDependencies(deps);
+}
+
+String getDependenciesHash(const Packages &deps, const Remote *current_remote)
+{
+    String s = current_remote->name + "\n";
+    for (auto &d : deps)
+        s += d.second.ppath.toString() + " " + d.second.version.toAnyVersion() + "\n";
+    return sha256(s);
 }
 
 Resolver::Dependencies prepareIdDependencies(const IdDependencies &id_deps, const Remote *current_remote)
@@ -28,6 +28,7 @@
 #include <boost/algorithm/string.hpp>
 #include <boost/nowide/fstream.hpp>
 
+#include <primitives/command.h>
 #include <primitives/hasher.h>
 #include <primitives/templates.h>
 
@@ -146,6 +147,7 @@ void Settings::load_main(const yaml &root, const SettingsType type)
     });
 
     YAML_EXTRACT_AUTO(disable_update_checks);
+    YAML_EXTRACT_AUTO(archive_cache_size);
     YAML_EXTRACT(storage_dir, String);
     YAML_EXTRACT(build_dir, String);
     YAML_EXTRACT(cppan_dir, String);
@@ -323,30 +325,42 @@ bool Settings::is_custom_build_dir() const
     return build_dir_type == SettingsType::Local || build_dir_type == SettingsType::None;
 }
 
+static void hash_build_settings(const Settings &s, Hasher &h)
+{
+    h |= s.c_compiler;
+    h |= s.cxx_compiler;
+    h |= s.compiler;
+    h |= s.c_compiler_flags;
+    for (int i = 0; i < Settings::CMakeConfigurationType::Max; i++)
+        h |= s.c_compiler_flags_conf[i];
+    h |= s.cxx_compiler_flags;
+    for (int i = 0; i < Settings::CMakeConfigurationType::Max; i++)
+        h |= s.cxx_compiler_flags_conf[i];
+    h |= s.compiler_flags;
+    for (int i = 0; i < Settings::CMakeConfigurationType::Max; i++)
+        h |= s.compiler_flags_conf[i];
+    h |= s.link_flags;
+    for (int i = 0; i < Settings::CMakeConfigurationType::Max; i++)
+        h |= s.link_flags_conf[i];
+    h |= s.link_libraries;
+    h |= s.generator;
+    h |= s.toolset;
+    h |= s.use_shared_libs;
+    h |= s.configuration;
+    h |= s.default_configuration;
+}
+
+String Settings::get_build_settings_hash() const
+{
+    Hasher h;
+    hash_build_settings(*this, h);
+    return h.hash;
+}
+
 String Settings::get_hash() const
 {
     Hasher h;
-    h |= c_compiler;
-    h |= cxx_compiler;
-    h |= compiler;
-    h |= c_compiler_flags;
-    for (int i = 0; i < CMakeConfigurationType::Max; i++)
-        h |= c_compiler_flags_conf[i];
-    h |= cxx_compiler_flags;
-    for (int i = 0; i < CMakeConfigurationType::Max; i++)
-        h |= cxx_compiler_flags_conf[i];
-    h |= compiler_flags;
-    for (int i = 0; i < CMakeConfigurationType::Max; i++)
-        h |= compiler_flags_conf[i];
-    h |= link_flags;
-    for (int i = 0; i < CMakeConfigurationType::Max; i++)
-        h |= link_flags_conf[i];
-    h |= link_libraries;
-    h |= generator;
-    h |= toolset;
-    h |= use_shared_libs;
-    h |= configuration;
-    h |= default_configuration;
+    hash_build_settings(*this, h);
 
     // besides we track all valuable ENV vars
     // to be sure that we'll load correct config
@@ -398,6 +412,98 @@ String Settings::get_hash() const
     return h.hash;
 }
 
+String get_compiler_fingerprint(const path &compiler)
+{
+    auto p = primitives::resolve_executable(compiler);
+    if (p.empty())
+        return String();
+    // cc -> gcc-7 etc.
+    p = fs::canonical(p);
+
+    // binary is hashed only when it changes
+    auto mtime = fs::last_write_time(p);
+    auto size = fs::file_size(p);
+    auto &sdb = getServiceDatabase();
+    auto fp = sdb.getCompilerFingerprint(p, mtime, size);
+    if (!fp.empty())
+        return fp;
+
+    Hasher h;
+    h |= normalize_path(p);
+    h |= sha256(read_file(p, true));
+
+    // version, target triple, sysroot
+    // unsupported options (msvc etc.) are just skipped
+    for (auto &a : { "--version", "-dumpmachine", "-print-sysroot" })
+    {
+        primitives::Command c;
+        c.program = p;
+        c.args.push_back(a);
+        std::error_code ec;
+        c.execute(ec);
+        if (!ec)
+            h |= c.out.text;
+    }
+
+    sdb.setCompilerFingerprint(p, mtime, size, h.hash);
+    return h.hash;
+}
+
+String Settings::get_toolchain_hash() const
+{
+    Hasher h;
+    hash_build_settings(*this, h);
+
+    // compilers cmake is going to pick up
+    auto add_compiler = [&h](String c, const char *env, const Strings &defaults)
+    {
+        if (c.empty())
+        {
+            if (auto e = getenv(env))
+                c = e;
+        }
+        Strings candidates;
+        if (!c.empty())
+            candidates.push_back(c);
+        else
+            candidates = defaults;
+        for (auto &c : candidates)
+        {
+            auto fp = get_compiler_fingerprint(c);
+            if (fp.empty())
+                continue;
+            h |= fp;
+            return;
+        }
+    };
+    add_compiler(c_compiler.empty() ? compiler : c_compiler, "CC", { "cc", "gcc", "clang" });
+    add_compiler(cxx_compiler.empty() ? compiler : cxx_compiler, "CXX", { "c++", "g++", "clang++" });
+
+    // env vars that change compiler behavior directly,
+    // PATH and friends are covered by resolved compilers
+    auto add_env = [&h](const char *var)
+    {
+        auto e = getenv(var);
+        if (!e)
+            return;
+        h |= String(var) + "=" + e;
+    };
+
+    // windows, msvc: cl.exe is not in PATH for vs generators
+    for (auto v : { "VSCOMNTOOLS", "VS71COMNTOOLS", "VS80COMNTOOLS", "VS90COMNTOOLS",
+        "VS100COMNTOOLS", "VS110COMNTOOLS", "VS120COMNTOOLS", "VS130COMNTOOLS",
+        "VS140COMNTOOLS", "VS141COMNTOOLS", "VS150COMNTOOLS", "VS151COMNTOOLS", "VS160COMNTOOLS",
+        "INCLUDE", "LIB" })
+        add_env(v);
+
+    // gcc, clang
+    for (auto v : { "CPATH", "COMPILER_PATH", "LIBRARY_PATH", "C_INCLUDE_PATH", "CPLUS_INCLUDE_PATH",
+        "OBJC_INCLUDE_PATH", "CFLAGS", "CXXFLAGS", "CPPFLAGS", "LDFLAGS", "SDKROOT", "MACOSX_DEPLOYMENT_TARGET" })
+        add_env(v);
+
+    return h.hash;
+}
+
 bool Settings::checkForUpdates() const
 {
     if (disable_update_checks)
@@ -30,6 +30,10 @@
 void cleanConfig(const String &config);
 void cleanConfigs(const Strings &configs);
 
+// hash of the resolved compiler binary, its version, target and sysroot
+// empty when compiler is not found
+String get_compiler_fingerprint(const path &compiler);
+
 struct BuildSettings
 {
     bool allow_links = true;
@@ -73,6 +77,8 @@ struct Settings
     PrinterType printerType{ PrinterType::CMake };
     // do not check for new cppan version
     bool disable_update_checks = false;
+    // max size of downloaded archives cache, in MB
+    int archive_cache_size = 2048;
 
     // build settings
     String c_compiler;
@@ -146,6 +152,11 @@ public:
 
     bool is_custom_build_dir() const;
     String get_hash() const;
+    // compilers, flags and configuration only
+    String get_build_settings_hash() const;
+    // identifies compilers by their binaries, version and target
+    // instead of env vars like PATH
+    String get_toolchain_hash() const;
     bool checkForUpdates() const;
 
 private:
@@ -113,6 +113,9 @@ sqlite3 *load_from_file(const path &fn, bool read_only)
         sqlite3_close(db);
         throw std::runtime_error(error);
     }
+    // threads of this process have their own connections and are not excluded by the file lock,
+    // so wait for other writers instead of failing with SQLITE_BUSY
+    sqlite3_busy_timeout(db, 60 * 1000);
     return db;
 }
 
@@ -153,6 +156,83 @@ void save_from_memory_to_file(const path &fn, sqlite3 *db)
     }
 }
 
+SqliteStatement::SqliteStatement(sqlite3 *db, const String &sql)
+    : db(db), sql(sql)
+{
+    if (sqlite3_prepare_v2(db, sql.c_str(), (int)sql.size() + 1, &stmt, nullptr) != SQLITE_OK)
+    {
+        auto s = sql.substr(0, MAX_ERROR_SQL_LENGTH);
+        if (sql.size() > MAX_ERROR_SQL_LENGTH)
+            s += "...";
+        throw std::runtime_error("Error preparing sql statement:\n" + s + "\nError: " + sqlite3_errmsg(db));
+    }
+}
+
+SqliteStatement::~SqliteStatement()
+{
+    sqlite3_finalize(stmt);
+}
+
+void SqliteStatement::bind(int i, int64_t v)
+{
+    if (sqlite3_bind_int64(stmt, i, v) != SQLITE_OK)
+        throw std::runtime_error("sqlite3_bind_int64() failed: " + String(sqlite3_errmsg(db)));
+}
+
+void SqliteStatement::bind(int i, const String &v)
+{
+    if (sqlite3_bind_text(stmt, i, v.c_str(), (int)v.size(), SQLITE_TRANSIENT) != SQLITE_OK)
+        throw std::runtime_error("sqlite3_bind_text() failed: " + String(sqlite3_errmsg(db)));
+}
+
+void SqliteStatement::bindNull(int i)
+{
+    if (sqlite3_bind_null(stmt, i) != SQLITE_OK)
+        throw std::runtime_error("sqlite3_bind_null() failed: " + String(sqlite3_errmsg(db)));
+}
+
+bool SqliteStatement::step()
+{
+    auto rc = sqlite3_step(stmt);
+    if (rc == SQLITE_ROW)
+        return true;
+    if (rc == SQLITE_DONE)
+        return false;
+    auto s = sql.substr(0, MAX_ERROR_SQL_LENGTH);
+    if (sql.size() > MAX_ERROR_SQL_LENGTH)
+        s += "...";
+    throw std::runtime_error("Error executing sql statement:\n" + s + "\nError: " + sqlite3_errmsg(db));
+}
+
+void SqliteStatement::reset()
+{
+    sqlite3_reset(stmt);
+    sqlite3_clear_bindings(stmt);
+}
+
+int SqliteStatement::getColumnCount() const
+{
+    return sqlite3_column_count(stmt);
+}
+
+bool SqliteStatement::isNull(int col) const
+{
+    return sqlite3_column_type(stmt, col) == SQLITE_NULL;
+}
+
+int64_t SqliteStatement::getInt64(int col) const
+{
+    return sqlite3_column_int64(stmt, col);
+}
+
+String SqliteStatement::getText(int col) const
+{
+    auto t = (const char *)sqlite3_column_text(stmt, col);
+    if (!t)
+        return String();
+    return String(t, sqlite3_column_bytes(stmt, col));
+}
+
 SqliteDatabase::SqliteDatabase()
 {
     db = open_in_memory();
@@ -187,6 +267,9 @@ void SqliteDatabase::close()
     // turn on only for memory db
     //save(fullName);
 
+    // finalize statements before closing the connection
+    statements.clear();
+
     sqlite3_close(db);
     db = nullptr;
 }
@@ -227,15 +310,13 @@ bool SqliteDatabase::execute(String sql, void *object, Sqlite3Callback callback,
 
     boost::trim(sql);
 
-    // lock always for now
-    ScopedFileLock lock(get_lock(fullName), std::defer_lock);
-    if (!read_only)
-        lock.lock();
+    auto lk = lock(sql);
 
     LOG_TRACE(logger, "Executing sql statement: " << sql);
     char *errmsg;
     String error;
     sqlite3_exec(db, sql.c_str(), callback, object, &errmsg);
+    unlock(sql, !errmsg);
     if (errmsg)
     {
         auto s = sql.substr(0, MAX_ERROR_SQL_LENGTH);
@@ -261,10 +342,7 @@ bool SqliteDatabase::execute(String sql, DatabaseCallback callback, bool nothrow
 
     boost::trim(sql);
 
-    // lock always for now
-    ScopedFileLock lock(get_lock(fullName), std::defer_lock);
-    if (!read_only)
-        lock.lock();
+    auto lk = lock(sql);
 
     //
     LOG_TRACE(logger, "Executing sql statement: " << sql);
@@ -278,6 +356,7 @@ bool SqliteDatabase::execute(String sql, DatabaseCallback callback, bool nothrow
         return 0;
     };
     int rc = sqlite3_exec(db, sql.c_str(), cb, &callback, &errmsg);
+    unlock(sql, !errmsg && rc == SQLITE_OK);
     if (errmsg)
     {
         auto s = sql.substr(0, MAX_ERROR_SQL_LENGTH);
@@ -310,6 +389,81 @@ bool SqliteDatabase::execute(String sql, DatabaseCallback callback, bool nothrow
     return error.empty();
 }
 
+SqliteStatement &SqliteDatabase::prepare(const String &sql) const
+{
+    if (!isLoaded())
+        throw std::runtime_error("db is not loaded");
+
+    auto i = statements.find(sql);
+    if (i != statements.end())
+        return *i->second;
+    auto stmt = std::make_unique<SqliteStatement>(db, sql);
+    auto &s = *stmt;
+    statements[sql] = std::move(stmt);
+    return s;
+}
+
+void SqliteDatabase::execute(SqliteStatement &stmt, StatementCallback callback) const
+{
+    if (!isLoaded())
+        throw std::runtime_error("db is not loaded");
+
+    auto lk = lock(stmt.getSql());
+
+    LOG_TRACE(logger, "Executing prepared sql statement: " << stmt.getSql());
+    try
+    {
+        while (stmt.step())
+        {
+            if (callback)
+                callback(stmt);
+        }
+    }
+    catch (...)
+    {
+        stmt.reset();
+        unlock(stmt.getSql(), false);
+        throw;
+    }
+    stmt.reset();
+    unlock(stmt.getSql(), true);
+}
+
+std::unique_ptr<ScopedFileLock> SqliteDatabase::lock(const String &sql) const
+{
+    if (read_only)
+        return {};
+
+    // statements inside own transaction are already under the lock
+    if (transaction_thread == std::this_thread::get_id())
+        return {};
+
+    auto lk = std::make_unique<ScopedFileLock>(get_lock(fullName), std::defer_lock);
+    lk->lock();
+    if (!boost::istarts_with(sql, "BEGIN"))
+        return lk;
+
+    // keep it until the end of transaction
+    transaction_lock = std::move(lk);
+    transaction_thread = std::this_thread::get_id();
+    return {};
+}
+
+void SqliteDatabase::unlock(const String &sql, bool ok) const
+{
+    if (transaction_thread != std::this_thread::get_id())
+        return;
+    // failed BEGIN does not start a transaction
+    if (boost::istarts_with(sql, "COMMIT") ||
+        boost::istarts_with(sql, "ROLLBACK") ||
+        boost::istarts_with(sql, "END") ||
+        (!ok && boost::istarts_with(sql, "BEGIN")))
+    {
+        transaction_thread = std::thread::id();
+        transaction_lock.reset();
+    }
+}
+
 path SqliteDatabase::getFullName() const
 {
     return fullName;
@@ -19,17 +19,66 @@
 #include "cppan_string.h"
 #include "filesystem.h"
 
+#include <atomic>
 #include <functional>
 #include <memory>
+#include <thread>
+#include <unordered_map>
 
 #define SQLITE_CALLBACK_ARGS int ncols, char** cols, char** names
 
 struct sqlite3;
+struct sqlite3_stmt;
+
+class ScopedFileLock;
+
+class SqliteDatabase;
+
+/// Prepared statement with typed bind and column accessors.
+/// Instances are owned by SqliteDatabase statement cache.
+class SqliteStatement
+{
+public:
+    SqliteStatement(sqlite3 *db, const String &sql);
+    SqliteStatement(const SqliteStatement &) = delete;
+    SqliteStatement &operator=(const SqliteStatement &) = delete;
+    ~SqliteStatement();
+
+    // parameters are 1-based as in sqlite
+    void bind(int i, int64_t v);
+    void bind(int i, const String &v);
+    void bindNull(int i);
+
+    template <typename ... Args>
+    void bindAll(Args && ... args)
+    {
+        int i = 1;
+        (bind(i++, std::forward<Args>(args)), ...);
+    }
+
+    // returns true when a row is available
+    bool step();
+    void reset();
+
+    // columns are 0-based as in sqlite
+    int getColumnCount() const;
+    bool isNull(int col) const;
+    int64_t getInt64(int col) const;
+    String getText(int col) const;
+
+    const String &getSql() const { return sql; }
+
+private:
+    sqlite3 *db;
+    sqlite3_stmt *stmt = nullptr;
+    String sql;
+};
 
 class SqliteDatabase
 {
     typedef int(*Sqlite3Callback)(void*, int /*ncols*/, char** /*cols*/, char** /*names*/);
     typedef std::function<int(int /*ncols*/, char** /*cols*/, char** /*names*/)> DatabaseCallback;
+    typedef std::function<void(const SqliteStatement &)> StatementCallback;
 
 public:
     SqliteDatabase();
@@ -49,6 +98,12 @@ public:
     bool execute(String sql, void *object, Sqlite3Callback callback, bool nothrow = false, String *errmsg = nullptr) const;
     bool execute(String sql, DatabaseCallback callback = DatabaseCallback(), bool nothrow = false, String *errmsg = nullptr) const;
 
+    // prepared statements are cached by query text, so use placeholders
+    // instead of inlining values into the query
+    SqliteStatement &prepare(const String &sql) const;
+    // runs already bound statement, calls callback on every row and resets it
+    void execute(SqliteStatement &stmt, StatementCallback callback = StatementCallback()) const;
+
     int getNumberOfColumns(const String &table) const;
     int getNumberOfTables() const;
     int64_t getLastRowId() const;
@@ -59,4 +114,11 @@ private:
     sqlite3 *db = nullptr;
     bool read_only = false;
     path fullName;
+    mutable std::unordered_map<String, std::unique_ptr<SqliteStatement>> statements;
+    // file lock is taken once for the whole transaction (BEGIN .. COMMIT/ROLLBACK)
+    mutable std::unique_ptr<ScopedFileLock> transaction_lock;
+    mutable std::atomic<std::thread::id> transaction_thread{};
+
+    std::unique_ptr<ScopedFileLock> lock(const String &sql) const;
+    void unlock(const String &sql, bool ok) const;
 };
@@ -17,6 +17,7 @@
 #include "cmake.h"
 
 #include <access_table.h>
+#include <checks_native.h>
 #include <database.h>
 #include <directories.h>
 #include <hash.h>
@@ -29,9 +30,13 @@
 
 #include <boost/algorithm/string.hpp>
 
+#include <mutex>
+#include <regex>
+
 #include <primitives/command.h>
 #include <primitives/date_time.h>
 #include <primitives/executor.h>
+#include <primitives/hasher.h>
 
 #include <primitives/log.h>
 DECLARE_STATIC_LOGGER(logger, "cmake");
@@ -121,6 +126,17 @@ public:
     }
 };
 
+// printers run on several threads, so lookups must not insert into rd
+const PackageStore::PackageConfig &get_package_config(const Package &p)
+{
+    static const PackageStore::PackageConfig empty{};
+    const auto &crd = rd;
+    auto i = crd.find(p);
+    if (i == crd.end())
+        return empty;
+    return i->second;
+}
+
 String cmake_debug_message(const String &s)
 {
     return cmake_debug_message_fun + "(\"" + s + "\")";
@@ -312,7 +328,7 @@ String prepare_include_directory(const String &i)
 void print_sdir_bdir(CMakeContext &ctx, const Package &d)
 {
     if (d.flags[pfLocalProject])
-        ctx.addLine("set(SDIR " + normalize_path(rd[d].config->getDefaultProject().root_directory) + ")");
+        ctx.addLine("set(SDIR " + normalize_path(get_package_config(d).config->getDefaultProject().root_directory) + ")");
     else
         ctx.addLine("set(SDIR ${CMAKE_CURRENT_SOURCE_DIR})");
     ctx.addLine("set(BDIR ${CMAKE_CURRENT_BINARY_DIR})");
@@ -331,7 +347,7 @@ String get_binary_path(const Package &d)
 
 void print_dependencies(CMakeContext &ctx, const Package &d, bool use_cache)
 {
-    const auto &dd = rd[d].dependencies;
+    const auto &dd = get_package_config(d).dependencies;
 
     if (dd.empty())
         return;
@@ -351,7 +367,7 @@ void print_dependencies(CMakeContext &ctx, const Package &d, bool use_cache)
 
         ScopedDependencyCondition sdc(ctx, dep);
         if (dep.flags[pfLocalProject])
-            ctx.addLine("set(" + dep.variable_no_version_name + "_DIR " + normalize_path(rd[dep].config->getDefaultProject().root_directory) + ")");
+            ctx.addLine("set(" + dep.variable_no_version_name + "_DIR " + normalize_path(get_package_config(dep).config->getDefaultProject().root_directory) + ")");
         else
             ctx.addLine("set(" + dep.variable_no_version_name + "_DIR " + normalize_path(dep.getDirSrc()) +  ")");
     }
@@ -416,7 +432,7 @@ void print_dependencies(CMakeContext &ctx, const Package &d, bool use_cache)
         if (!d.empty())
         {
             ctx.addLine("set(CPPAN_BUILD_EXECUTABLES_WITH_SAME_CONFIG "s + (
-                rd[d].config->getDefaultProject().build_dependencies_with_same_config ? "1" : "0") + ")");
+                get_package_config(d).config->getDefaultProject().build_dependencies_with_same_config ? "1" : "0") + ")");
             ctx.addLine();
         }
 
@@ -465,7 +481,7 @@ void gather_build_deps(const Packages &dd, Packages &out, bool recursive = false
         }
         auto i = out.insert(dp);
         if (i.second && recursive)
-            gather_build_deps(rd[d].dependencies, out, recursive, depth + 1);
+            gather_build_deps(get_package_config(d).dependencies, out, recursive, depth + 1);
     }
 }
 
@@ -494,7 +510,7 @@ void gather_copy_deps(const Packages &dd, Packages &out)
         }
         auto i = out.insert(dp);
         if (i.second)
-            gather_copy_deps(rd[d].dependencies, out);
+            gather_copy_deps(get_package_config(d).dependencies, out);
     }
 }
 
@@ -532,7 +548,7 @@ void CMakePrinter::print_build_dependencies(CMakeContext &ctx, const String &tar
     // We build all deps because if some dep is removed,
     // build system give you and error about this.
     Packages build_deps;
-    gather_build_deps(rd[d].dependencies, build_deps, true);
+    gather_build_deps(get_package_config(d).dependencies, build_deps, true);
 
     if (!build_deps.empty())
     {
@@ -557,7 +573,7 @@ void CMakePrinter::print_build_dependencies(CMakeContext &ctx, const String &tar
 
         // TODO: check with ninja and remove if ok
         //Packages build_deps_all;
-        //gather_build_deps(rd[d].dependencies, build_deps_all, true);
+        //gather_build_deps(get_package_config(d).dependencies, build_deps_all, true);
         //for (auto &dp : build_deps_all)
         for (auto &dp : build_deps)
         {
@@ -792,7 +808,7 @@ void CMakePrinter::print_copy_dependencies(CMakeContext &ctx, const String &targ
     ctx.addLine();
 
     Packages copy_deps;
-    gather_copy_deps(rd[d].dependencies, copy_deps);
+    gather_copy_deps(get_package_config(d).dependencies, copy_deps);
     for (auto &dp : copy_deps)
     {
         auto &p = dp.second;
@@ -825,7 +841,7 @@ void CMakePrinter::print_copy_dependencies(CMakeContext &ctx, const String &targ
         ctx.addLine();
 
         auto output_directory = "${output_dir}/"s;
-        output_directory += rd[p].config->getDefaultProject().output_directory + "/";
+        output_directory += get_package_config(p).config->getDefaultProject().output_directory + "/";
 
         ctx.if_("copy");
         {
@@ -834,7 +850,7 @@ void CMakePrinter::print_copy_dependencies(CMakeContext &ctx, const String &targ
             s += "set(copy_content \"${copy_content} @\")\n";
 #endif
             s += "set(copy_content \"${copy_content} \\\"${CMAKE_COMMAND}\\\" -E copy_if_different ";
-            if (p.flags[pfExecutable] || (p.flags[pfLocalProject] && rd[p].config->getDefaultProject().type == ProjectType::Executable))
+            if (p.flags[pfExecutable] || (p.flags[pfLocalProject] && get_package_config(p).config->getDefaultProject().type == ProjectType::Executable))
             {
                 String name;
                 if (settings.full_path_executables)
@@ -1067,14 +1083,14 @@ endif()
     // trigger building of requested target(s)
     /*ctx.addLine("add_custom_target(cppan_all ALL)");
     ctx.increaseIndent("add_dependencies(cppan_all ");
-    for (auto &d : rd[d].dependencies)
+    for (auto &d : get_package_config(d).dependencies)
         ctx.addLine(d.second.target_name);
     ctx.decreaseIndent(")");
     ctx.addLine();*/
 
     // vs startup project
     bool once = false;
-    for (auto &dep : rd[Package()].dependencies)
+    for (auto &dep : get_package_config(Package()).dependencies)
     {
         if (!dep.second.flags[pfLocalProject])
             continue;
@@ -1264,12 +1280,27 @@ void CMakePrinter::print() const
     print_configs();
 }
 
+bool CMakePrinter::is_printed() const
+{
+    if (!fs::exists(d.getDirSrc() / cmake_config_filename) ||
+        !fs::exists(cwd / settings.cppan_dir / cmake_config_filename))
+        return false;
+    if (d.flags[pfHeaderOnly])
+        return true;
+    auto obj_dir = d.getDirObj();
+    return fs::exists(obj_dir / cmake_config_filename) &&
+           fs::exists(obj_dir / cmake_obj_generate_filename);
+}
+
 void CMakePrinter::print_meta() const
 {
     print_meta_config_file(cwd / settings.cppan_dir / cmake_config_filename);
     print_helper_file(cwd / settings.cppan_dir / cmake_helpers_filename);
 
     // print inserted files (they'll be printed only once)
+    // printers run in parallel, do not write the same files simultaneously
+    static std::mutex m;
+    std::unique_lock<std::mutex> lk(m);
     access_table->write_if_older(directories.get_static_files_dir() / cmake_functions_filename,
         "# global options from cppan source code\n"
         "set(CPPAN_CONFIG_HASH_METHOD " CPPAN_CONFIG_HASH_METHOD ")\n"
@@ -1285,6 +1316,7 @@ void CMakePrinter::print_meta() const
     access_table->write_if_older(directories.get_static_files_dir() / "branch.rc.in", branch_rc_in);
     access_table->write_if_older(directories.get_static_files_dir() / "version.rc.in", version_rc_in);
     access_table->write_if_older(directories.get_include_dir() / CPP_HEADER_FILENAME, cppan_h);
+    lk.unlock();
 
     if (d.empty())
     {
@@ -1292,7 +1324,7 @@ void CMakePrinter::print_meta() const
         access_table->write_if_older(cwd / settings.cppan_dir / CPP_HEADER_FILENAME, cppan_h);
 
         // checks file
-        access_table->write_if_older(cwd / settings.cppan_dir / cppan_checks_yml, rd[d].config->getDefaultProject().checks.save());
+        access_table->write_if_older(cwd / settings.cppan_dir / cppan_checks_yml, get_package_config(d).config->getDefaultProject().checks.save());
     }
 }
 
@@ -1351,7 +1383,8 @@ void CMakePrinter::print_bs_insertion(CMakeContext &ctx, const Project &p, const
 
 void CMakePrinter::print_references(CMakeContext &ctx) const
 {
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
+    const auto &deps = get_package_config(d).dependencies;
 
     config_section_title(ctx, "references");
     for (const auto &dep : p.dependencies)
@@ -1360,12 +1393,14 @@ void CMakePrinter::print_references(CMakeContext &ctx) const
         if (dd.reference.empty())
             continue;
         ScopedDependencyCondition sdc(ctx, dd);
-        ctx.addLine("set(" + dd.reference + " " + rd[d].dependencies[dd.ppath.toString()].target_name + ")");
+        auto i = deps.find(dd.ppath.toString());
+        auto rdep = i == deps.end() ? Package() : i->second;
+        ctx.addLine("set(" + dd.reference + " " + rdep.target_name + ")");
         if (dd.ppath.is_loc())
             ctx.addLine("set(" + dd.reference + "_SDIR " + normalize_path(rd.get_local_package_dir(dd.ppath.toString())) + ")");
         else
-            ctx.addLine("set(" + dd.reference + "_SDIR " + normalize_path(rd[d].dependencies[dd.ppath.toString()].getDirSrc()) + ")");
-        ctx.addLine("set(" + dd.reference + "_BDIR " + normalize_path(rd[d].dependencies[dd.ppath.toString()].getDirObj()) + ")");
+            ctx.addLine("set(" + dd.reference + "_SDIR " + normalize_path(rdep.getDirSrc()) + ")");
+        ctx.addLine("set(" + dd.reference + "_BDIR " + normalize_path(rdep.getDirObj()) + ")");
         ctx.addLine("set(" + dd.reference + "_DIR ${" + dd.reference + "_SDIR})");
         ctx.addLine();
     }
@@ -1373,7 +1408,7 @@ void CMakePrinter::print_references(CMakeContext &ctx) const
 
 void CMakePrinter::print_settings(CMakeContext &ctx) const
 {
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
 
     config_section_title(ctx, "settings");
     print_storage_dirs(ctx);
@@ -1534,7 +1569,7 @@ void CMakePrinter::print_src_config_file(const path &fn) const
     if (!must_update_contents(fn))
         return;
 
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
 
     CMakeContext ctx;
     file_header(ctx, d);
@@ -1750,7 +1785,7 @@ endif()
     // include directories
     {
         std::vector<Package> include_deps;
-        for (auto &dep : rd[d].dependencies)
+        for (auto &dep : get_package_config(d).dependencies)
         {
             if (!dep.second.flags[pfIncludeDirectoriesOnly])
                 continue;
@@ -1767,7 +1802,7 @@ endif()
 
                 for (auto &pkg : include_deps)
                 {
-                    auto &proj = rd[pkg].config->getDefaultProject();
+                    auto &proj = get_package_config(pkg).config->getDefaultProject();
                     // only public idirs here
                     for (auto &i : proj.include_directories.public_)
                     {
@@ -1862,7 +1897,7 @@ endif()
     {
         config_section_title(ctx, "dependencies");
 
-        for (auto &[k,v] : rd[d].dependencies)
+        for (auto &[k,v] : get_package_config(d).dependencies)
         {
             if (v.flags[pfExecutable] || v.flags[pfIncludeDirectoriesOnly])
                 continue;
@@ -2230,7 +2265,7 @@ void CMakePrinter::print_src_actions_file(const path &fn) const
     if (!must_update_contents(fn))
         return;
 
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
 
     CMakeContext ctx;
     file_header(ctx, d);
@@ -2297,7 +2332,7 @@ void CMakePrinter::print_obj_config_file(const path &fn) const
     if (!must_update_contents(fn))
         return;
 
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
 
     CMakeContext ctx;
     file_header(ctx, d);
@@ -2410,7 +2445,7 @@ void CMakePrinter::print_obj_generate_file(const path &fn) const
     if (!must_update_contents(fn))
         return;
 
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
 
     CMakeContext ctx;
     file_header(ctx, d);
@@ -2512,7 +2547,7 @@ void CMakePrinter::print_obj_export_file(const path &fn) const
     // before every export include 'cmake_obj_generate_filename'
     // set CPPAN_BUILD_EXECUTABLES_WITH_SAME_CONFIG var
     ctx.addLine("set(CPPAN_BUILD_EXECUTABLES_WITH_SAME_CONFIG "s + (
-        rd[d].config->getDefaultProject().build_dependencies_with_same_config ? "1" : "0") + ")");
+        get_package_config(d).config->getDefaultProject().build_dependencies_with_same_config ? "1" : "0") + ")");
     ctx.addLine();
 
     // we skip executables because they may introduce wrong targets
@@ -2520,7 +2555,7 @@ void CMakePrinter::print_obj_export_file(const path &fn) const
     if (!d.flags[pfDirectDependency] && d.flags[pfExecutable])
         ctx.if_("CPPAN_BUILD_EXECUTABLES_WITH_SAME_CONFIG");
 
-    for (auto &dp : rd[d].dependencies)
+    for (auto &dp : get_package_config(d).dependencies)
     {
         auto &dep = dp.second;
 
@@ -2670,7 +2705,7 @@ endif()
         // lib
         config_section_title(ctx, "main library");
         ctx.addLine("add_library                   (" + old_cppan_target + " INTERFACE)");
-        for (auto &p : rd[d].dependencies)
+        for (auto &p : get_package_config(d).dependencies)
         {
             if (p.second.flags[pfExecutable] || p.second.flags[pfIncludeDirectoriesOnly])
                 continue;
@@ -2722,7 +2757,7 @@ add_dependencies()" + old_cppan_target + R"( run-cppan)
         ctx.endif();
         ctx.emptyLines();
 
-        for (auto &dep : rd[d].dependencies)
+        for (auto &dep : get_package_config(d).dependencies)
         {
             if (!dep.second.flags[pfLocalProject])
                 continue;
@@ -2744,7 +2779,7 @@ void CMakePrinter::print_helper_file(const path &fn) const
     if (!must_update_contents(fn))
         return;
 
-    const auto &p = rd[d].config->getDefaultProject();
+    const auto &p = get_package_config(d).config->getDefaultProject();
 
     CMakeContext ctx;
     file_header(ctx, d);
@@ -2891,6 +2926,7 @@ endif()
                                 \"${CMAKE_GENERATOR}\"
                                 \"${CMAKE_GENERATOR_TOOLSET}\"
                                 \"${CMAKE_TOOLCHAIN_FILE}\"
+                                \")"s + settings.get_build_settings_hash() + R"(\"
                             )"s;
             ctx.if_("CPPAN_COMMAND");
             ctx.addLine("cppan_debug_message(\"" + cmd + "\")");
@@ -2966,19 +3002,13 @@ void CMakePrinter::parallel_vars_check(const ParallelCheckOptions &o) const
     if (us.var_check_jobs > 0)
         N = std::min<int>(N, us.var_check_jobs);
 
-    if (N <= 1)
-    {
-        LOG_DEBUG(logger, "-- Sequential checks mode selected");
-        return;
-    }
-
     Checks checks;
     checks.load(o.checks_file);
 
     // read known vars
+    std::map<String, String> known_vars;
     if (fs::exists(o.vars_file))
     {
-        std::set<String> known_vars;
         std::vector<String> lines;
         {
             ScopedShareableFileLock lock(o.vars_file);
@@ -2989,12 +3019,59 @@ void CMakePrinter::parallel_vars_check(const ParallelCheckOptions &o) const
             std::vector<String> v;
             boost::split(v, l, boost::is_any_of(";"));
             if (v.size() == 3)
-                known_vars.insert(v[1]);
+                known_vars[v[1]] = v[2];
         }
-        checks.remove_known_vars(known_vars);
     }
 
-    auto workers = checks.scatter(N);
+    // values evaluated earlier by any project with the same toolchain
+    auto toolchain_hash = o.getToolchainHash();
+    auto evaluated = checks.remove_known_vars(known_vars, toolchain_hash);
+    if (!evaluated.empty())
+        LOG_DEBUG(logger, "-- " << evaluated.checks.size() << " check values were taken from cache");
+
+    auto write_results = [&o, &evaluated]()
+    {
+        evaluated.print_values();
+        LOG_FLUSH();
+
+        CMakeContext ctx;
+        evaluated.print_values(ctx);
+        write_file(o.dir / parallel_checks_file, ctx.getText());
+    };
+
+    // evaluate what we can by calling the compiler directly,
+    // the rest goes to cmake workers
+    CheckDurations durations;
+    durations.load();
+
+    NativeChecker native(o);
+    if (native.isAvailable())
+    {
+        int n_native = std::max(N, 1);
+        Checks native_checks;
+        auto t = get_time<std::chrono::milliseconds>([&checks, &native_checks, &native, &n_native, &durations]
+        {
+            native_checks = native.run(checks, n_native, durations);
+        });
+        durations.save();
+        if (!native_checks.empty())
+        {
+            LOG_INFO(logger, "-- Performed " << native_checks.checks.size() << " checks natively using " << n_native << " thread(s) in " << t << " ms");
+            native_checks.save_values(toolchain_hash);
+            evaluated += native_checks;
+        }
+    }
+
+    // the rest is checked sequentially by cmake itself
+    if (N <= 1)
+    {
+        LOG_DEBUG(logger, "-- Sequential checks mode selected");
+        if (!evaluated.empty())
+            write_results();
+        return;
+    }
+
+    auto workers = checks.scatter(N, durations);
     size_t n_checks = 0;
     for (auto &w : workers)
         n_checks += w.checks.size();
@@ -3003,6 +3080,8 @@ void CMakePrinter::parallel_vars_check(const ParallelCheckOptions &o) const
     if (n_checks <= 8)
     {
         LOG_DEBUG(logger, "-- There are few checks (" << n_checks << ") only. Won't go in parallel mode.");
+        if (!evaluated.empty())
+            write_results();
         return;
     }
 
@@ -3014,7 +3093,8 @@ void CMakePrinter::parallel_vars_check(const ParallelCheckOptions &o) const
 #endif
     LOG_FLUSH();
 
-    auto work = [&o, &N](auto &w, int i)
+    std::vector<int> failed(workers.size());
+    auto work = [&o, &N, &failed](auto &w, int i)
     {
         if (w.checks.empty())
             return;
@@ -3102,7 +3182,10 @@ void CMakePrinter::parallel_vars_check(const ParallelCheckOptions &o) const
 
         // do not fail (throw), try to read already found variables
         if (c.exit_code)
+        {
             LOG_WARN(logger, "-- Thread #" << i << ": error during evaluating variables");
+            failed[i] = 1;
+        }
 
         w.read_parallel_checks_for_workers(d);
     };
@@ -3110,21 +3193,46 @@ void CMakePrinter::parallel_vars_check(const ParallelCheckOptions &o) const
     Executor e(N);
     e.throw_exceptions = true;
 
+    std::vector<int64_t> times(workers.size());
     int i = 0;
     for (auto &w : workers)
-        e.push([&work, &w, n = i++]() { work(w, n); });
+    {
+        e.push([&work, &w, &times, n = i++]()
+        {
+            times[n] = get_time<std::chrono::milliseconds>([&work, &w, n] { work(w, n); });
+        });
+    }
 
     auto t = get_time<std::chrono::seconds>([&e] { e.wait(); });
 
-    for (auto &w : workers)
-        checks += w;
+    // values of failed workers may be incomplete, do not remember them
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        if (!failed[i])
+            workers[i].save_values(toolchain_hash);
+        evaluated += workers[i];
+    }
+    write_results();
 
-    checks.print_values();
-    LOG_FLUSH();
+    // cmake reports only the time of the whole worker,
+    // so split it between its checks using previous estimates
+    auto critical_path = *std::max_element(times.begin(), times.end());
+    String utilization;
+    for (size_t i = 0; i < workers.size(); i++)
+    {
+        if (critical_path)
+            utilization += " " + std::to_string(times[i] * 100 / critical_path) + "%";
+        if (failed[i] || workers[i].checks.empty())
+            continue;
+        int64_t estimated = 0;
+        for (auto &c : workers[i].checks)
+            estimated += durations.get(*c);
+        for (auto &c : workers[i].checks)
+            durations.set(*c, estimated ? times[i] * durations.get(*c) / estimated : 0);
+    }
+    durations.save();
 
-    CMakeContext ctx;
-    checks.print_values(ctx);
-    write_file(o.dir / parallel_checks_file, ctx.getText());
+    LOG_INFO(logger, "-- Critical path: " << critical_path << " ms, worker utilization:" << utilization);
 
     LOG_INFO(logger, "-- This operation took " + std::to_string(t) + " seconds to complete");
 }
@@ -3149,53 +3257,39 @@ void CMakePrinter::write_if_older(const path &fn, const String &s) const
 
 void CMakePrinter::print_source_groups(CMakeContext &ctx) const
 {
-    // disabled as very very slow!
-    return;
-
     // check own data
     if (sgs.empty())
     {
-        // check db data
-        auto &sdb = getServiceDatabaseReadOnly();
-        sgs = sdb.getSourceGroups(d);
+        // groups of a downloaded package are valid until it is downloaded again
+        if (!d.flags[pfLocalProject])
+            sgs = getServiceDatabaseReadOnly().getSourceGroups(d);
         if (sgs.empty())
         {
-            if (d.flags[pfLocalProject])
+            const auto &p = get_package_config(d).config->getDefaultProject();
+            auto root = normalize_path(fs::absolute(d.flags[pfLocalProject] ? p.root_directory : d.getDirSrc()));
+            if (!root.empty() && root.back() != '/')
+                root += "/";
+            // sources of local projects are found already,
+            // a downloaded package is walked once, then its groups are cached
+            for (auto &f : p.getSources())
             {
-                const auto &p = rd[d].config->getDefaultProject();
-                for (auto &f : p.files)
-                {
-                    auto r = fs::relative(f, p.root_directory);
-                    auto s2 = boost::replace_all_copy(r.parent_path().string(), "\\", "\\\\");
-                    boost::replace_all(s2, "/", "\\\\");
-                    sgs[s2].insert(normalize_path(f));
-                }
+                auto s = normalize_path(f);
+                if (s.compare(0, root.size(), root) != 0)
+                    continue;
+                // files of the root dir are not grouped
+                auto pos = s.rfind('/');
+                if (pos < root.size())
+                    continue;
+                auto s2 = boost::replace_all_copy(s.substr(root.size(), pos - root.size()), "/", "\\\\");
+                sgs[s2].insert(s);
             }
-            else
+            if (!d.flags[pfLocalProject])
             {
-                const auto dir = d.getDirSrc();
-                for (auto &f : boost::make_iterator_range(fs::recursive_directory_iterator(dir), {}))
-                {
-                    if (!fs::is_directory(f))
-                        continue;
-
-                    auto s = fs::relative(f.path(), dir).string();
-                    auto s2 = boost::replace_all_copy(s, "\\", "\\\\");
-                    boost::replace_all(s2, "/", "\\\\");
-
-                    for (auto &f2 : boost::make_iterator_range(fs::directory_iterator(f), {}))
-                    {
-                        if (!fs::is_regular_file(f2))
-                            continue;
-                        auto s3 = normalize_path(f2.path());
-                        sgs[s2].insert(s3);
-                    }
-                }
+                // add empty sgs to prevent files lookup on the next run
+                if (sgs.empty())
+                    sgs["__cppan_empty"];
+                new_source_groups = sgs;
             }
-            // add empty sgs to prevent directory lookup on the next run
-            if (sgs.empty())
-                sgs["__cppan_empty"];
-            getServiceDatabase().setSourceGroups(d, sgs);
         }
     }
 
@@ -3204,6 +3298,8 @@ void CMakePrinter::print_source_groups(CMakeContext &ctx) const
     ctx.addLine("source_group(\"generated\" REGULAR_EXPRESSION \"" + normalize_path(d.getDirObj()) + "/*\")");
     for (auto &sg : sgs)
     {
+        if (sg.second.empty())
+            continue;
         ctx.increaseIndent("source_group(\"" + sg.first + "\" FILES");
         for (auto &f : sg.second)
             ctx.addLine("\"" + f + "\"");
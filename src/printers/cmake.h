@@ -35,6 +35,7 @@ struct CMakePrinter : Printer
 
     void print() const override;
     void print_meta() const override;
+    bool is_printed() const override;
 
     void clear_cache() const override;
     void clear_exports() const override;
@@ -111,7 +112,9 @@ void add_aliases(Context &ctx, const Package &d, bool all, const StringSet &alia
 template <class F>
 void add_aliases(Context &ctx, const Package &d, bool all, F &&f)
 {
-    const auto &aliases = rd[d].config->getDefaultProject().aliases;
+    // const lookup, printers run on several threads
+    const auto &crd = rd;
+    const auto &aliases = crd[d].config->getDefaultProject().aliases;
     add_aliases(ctx, d, all, aliases, std::forward<F>(f));
 }
 
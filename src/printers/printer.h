@@ -51,6 +51,9 @@ struct Printer
     class AccessTable *access_table = nullptr;
     path cwd;
     Settings &settings;
+    // source groups computed by print(), printers run on several threads,
+    // so they are stored by the caller
+    mutable SourceGroups new_source_groups;
 
     Printer();
 
@@ -61,6 +64,8 @@ struct Printer
 
     virtual void print() const = 0;
     virtual void print_meta() const = 0;
+    // main files of print() and print_meta() exist
+    virtual bool is_printed() const = 0;
 
     virtual void clear_cache() const = 0;
     virtual void clear_exports() const = 0;
@@ -16,6 +16,29 @@
 
 #include "filesystem.h"
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef __linux__
+#include <dirent.h>
+#include <sys/syscall.h>
+#endif
+
 path get_config_filename()
 {
     return get_root_directory() / CPPAN_FILENAME;
@@ -89,3 +112,496 @@ path findRootDirectory(const path &p)
     findRootDirectory1(p, root);
     return root;
 }
+
+namespace
+{
+
+#ifdef __linux__
+struct linux_dirent64
+{
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[256];
+};
+
+// d_type from getdents64 saves a stat call per entry on most filesystems
+template <class F>
+void read_directory(const path &dir, F &&f)
+{
+    int fd = open(dir.string().c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1)
+        throw std::runtime_error("Cannot open directory: " + dir.string());
+
+    alignas(linux_dirent64) char buf[32 * 1024];
+    while (1)
+    {
+        auto n = syscall(SYS_getdents64, fd, buf, sizeof(buf));
+        if (n == -1)
+        {
+            close(fd);
+            throw std::runtime_error("Cannot read directory: " + dir.string());
+        }
+        if (n == 0)
+            break;
+        for (long pos = 0; pos < n;)
+        {
+            auto d = (linux_dirent64 *)(buf + pos);
+            pos += d->d_reclen;
+
+            auto name = d->d_name;
+            if (name[0] == '.' && (name[1] == 0 || (name[1] == '.' && name[2] == 0)))
+                continue;
+
+            auto type = d->d_type;
+            if (type == DT_UNKNOWN)
+            {
+                struct stat st;
+                if (fstatat(fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1)
+                    continue;
+                if (S_ISDIR(st.st_mode))
+                    type = DT_DIR;
+                else if (S_ISREG(st.st_mode))
+                    type = DT_REG;
+                else if (S_ISLNK(st.st_mode))
+                    type = DT_LNK;
+            }
+            // symlinks to regular files are files
+            if (type == DT_LNK)
+            {
+                struct stat st;
+                if (fstatat(fd, name, &st, 0) == 0 && S_ISREG(st.st_mode))
+                    type = DT_REG;
+            }
+
+            if (type == DT_DIR)
+                f(name, true);
+            else if (type == DT_REG)
+                f(name, false);
+        }
+    }
+    close(fd);
+}
+#else
+template <class F>
+void read_directory(const path &dir, F &&f)
+{
+    for (auto &e : boost::make_iterator_range(fs::directory_iterator(dir), {}))
+    {
+        if (fs::is_directory(e.symlink_status()))
+            f(e.path().filename().string(), true);
+        else if (fs::is_regular_file(e))
+            f(e.path().filename().string(), false);
+    }
+}
+#endif
+
+}
+
+using DirTimes = std::vector<std::pair<String, time_t>>;
+
+// extra threads of all running walks, walks started from several threads
+// (or from a filter) share the cores instead of taking all of them each
+static std::atomic_int n_walk_threads{ 0 };
+
+static int reserve_walk_threads(int n)
+{
+    int max = std::max(1u, std::thread::hardware_concurrency()) - 1;
+    auto cur = n_walk_threads.load();
+    while (true)
+    {
+        auto k = std::min(n, max - cur);
+        if (k <= 0)
+            return 0;
+        if (n_walk_threads.compare_exchange_weak(cur, cur + k))
+            return k;
+    }
+}
+
+// walks root / rel, mtimes of visited dirs are taken before reading them
+static std::vector<WalkEntry> walk_tree(const path &root, const String &rel, const WalkFilter &enter_dir,
+                                        int n_threads, DirTimes *dir_times)
+{
+    if (n_threads <= 0)
+        n_threads = std::max(1u, std::thread::hardware_concurrency());
+    n_threads = 1 + reserve_walk_threads(n_threads - 1);
+
+    // every thread takes dirs from the back of its own queue
+    // and steals from the front of others when it is empty
+    struct Queue
+    {
+        std::mutex m;
+        std::deque<WalkEntry> dirs;
+    };
+
+    std::vector<Queue> queues(n_threads);
+    std::vector<std::vector<WalkEntry>> files(n_threads);
+    std::vector<DirTimes> times(n_threads);
+    // queued and in progress dirs
+    std::atomic_size_t pending{ 1 };
+    std::atomic_size_t queued{ 1 };
+    std::atomic_bool stop{ false };
+    std::exception_ptr eptr;
+    std::mutex eptr_m;
+
+    // idle threads sleep until a dir is queued or the walk is over
+    std::mutex idle_m;
+    std::condition_variable idle_cv;
+    auto wake = [&idle_m, &idle_cv](bool all)
+    {
+        // taking the lock makes sure a thread checking the condition does not miss it
+        std::unique_lock<std::mutex> lk(idle_m);
+        if (all)
+            idle_cv.notify_all();
+        else
+            idle_cv.notify_one();
+    };
+
+    queues[0].dirs.push_back({ rel.empty() ? root : root / rel, rel });
+
+    auto pop = [&queues, &queued, n_threads](int i, WalkEntry &d)
+    {
+        {
+            auto &q = queues[i];
+            std::unique_lock<std::mutex> lk(q.m);
+            if (!q.dirs.empty())
+            {
+                d = std::move(q.dirs.back());
+                q.dirs.pop_back();
+                queued--;
+                return true;
+            }
+        }
+        for (int j = 1; j < n_threads; j++)
+        {
+            auto &q = queues[(i + j) % n_threads];
+            std::unique_lock<std::mutex> lk(q.m);
+            if (!q.dirs.empty())
+            {
+                d = std::move(q.dirs.front());
+                q.dirs.pop_front();
+                queued--;
+                return true;
+            }
+        }
+        return false;
+    };
+
+    auto worker = [&](int i)
+    {
+        WalkEntry d;
+        while (pending && !stop)
+        {
+            if (!pop(i, d))
+            {
+                std::unique_lock<std::mutex> lk(idle_m);
+                idle_cv.wait(lk, [&] { return !pending || stop || queued; });
+                continue;
+            }
+            try
+            {
+                if (dir_times)
+                    times[i].emplace_back(d.rel, fs::last_write_time(d.p));
+                read_directory(d.p, [&](const String &name, bool dir)
+                {
+                    auto rel = d.rel.empty() ? name : d.rel + "/" + name;
+                    if (!dir)
+                    {
+                        files[i].push_back({ d.p / name, rel });
+                        return;
+                    }
+                    if (enter_dir && !enter_dir(rel))
+                        return;
+                    pending++;
+                    {
+                        auto &q = queues[i];
+                        std::unique_lock<std::mutex> lk(q.m);
+                        q.dirs.push_back({ d.p / name, rel });
+                        queued++;
+                    }
+                    if (n_threads > 1)
+                        wake(false);
+                });
+            }
+            catch (...)
+            {
+                {
+                    std::unique_lock<std::mutex> lk(eptr_m);
+                    if (!eptr)
+                        eptr = std::current_exception();
+                }
+                stop = true;
+                wake(true);
+            }
+            if (--pending == 0)
+                wake(true);
+        }
+    };
+
+    std::vector<std::thread> threads;
+    for (int i = 1; i < n_threads; i++)
+        threads.emplace_back(worker, i);
+    worker(0);
+    for (auto &t : threads)
+        t.join();
+    n_walk_threads -= n_threads - 1;
+    if (eptr)
+        std::rethrow_exception(eptr);
+
+    if (dir_times)
+    {
+        for (auto &t : times)
+            dir_times->insert(dir_times->end(), t.begin(), t.end());
+    }
+
+    std::vector<WalkEntry> result;
+    for (auto &f : files)
+        std::move(f.begin(), f.end(), std::back_inserter(result));
+    std::sort(result.begin(), result.end(), [](const auto &e1, const auto &e2)
+    {
+        return e1.rel < e2.rel;
+    });
+    return result;
+}
+
+std::vector<WalkEntry> walk_directory(const path &root, const WalkFilter &enter_dir, int n_threads)
+{
+    return walk_tree(root, String(), enter_dir, n_threads, nullptr);
+}
+
+std::vector<WalkEntry> walk_directory(const path &root, const path &index_fn, const WalkFilter &enter_dir)
+{
+    struct Dir
+    {
+        time_t mtime = 0;
+        Strings files;
+        Strings dirs;
+    };
+    using Index = std::map<String, Dir>;
+
+    static const String index_version = "1";
+    auto root_s = normalize_path(root);
+
+    // format: version, root, then records
+    // 'd <mtime> <rel dir>' followed by its 'f <file>' and 's <subdir>' lines
+    Index index;
+    if (fs::exists(index_fn))
+    {
+        std::istringstream ss(read_file(index_fn));
+        String v, r, line;
+        std::getline(ss, v);
+        std::getline(ss, r);
+        if (v == index_version && r == root_s)
+        {
+            Dir *d = nullptr;
+            while (std::getline(ss, line))
+            {
+                if (line.size() < 2)
+                    continue;
+                if (line[0] == 'd')
+                {
+                    auto pos = line.find(' ', 2);
+                    if (pos == String::npos)
+                        break;
+                    d = &index[line.substr(pos + 1)];
+                    d->mtime = (time_t)std::stoll(line.substr(2, pos - 2));
+                }
+                else if (d && line[0] == 'f')
+                    d->files.push_back(line.substr(2));
+                else if (d && line[0] == 's')
+                    d->dirs.push_back(line.substr(2));
+            }
+        }
+    }
+
+    auto join = [](const String &rel, const String &name)
+    {
+        return rel.empty() ? name : rel + "/" + name;
+    };
+
+    Index new_index;
+    bool changed = false;
+    // dirs changed after this moment may change again in the same second unnoticed
+    auto start = time(nullptr);
+
+    // reads a new subtree
+    auto walk = [&](const String &rel)
+    {
+        DirTimes times;
+        auto files = walk_tree(root, rel, enter_dir, 0, &times);
+        for (auto &t : times)
+        {
+            new_index[t.first].mtime = t.second;
+            if (t.first == rel)
+                continue;
+            auto pos = t.first.rfind('/');
+            new_index[pos == String::npos ? String() : t.first.substr(0, pos)].dirs.push_back(t.first.substr(pos + 1));
+        }
+        for (auto &f : files)
+        {
+            auto pos = f.rel.rfind('/');
+            new_index[pos == String::npos ? String() : f.rel.substr(0, pos)].files.push_back(f.rel.substr(pos + 1));
+        }
+        changed = true;
+    };
+
+    // only dirs with a different mtime are read again, removed dirs are dropped
+    std::function<void(const String &)> check = [&](const String &rel)
+    {
+        auto &old = index[rel];
+        boost::system::error_code ec;
+        auto p = rel.empty() ? root : root / rel;
+        auto mtime = fs::last_write_time(p, ec);
+        if (ec)
+        {
+            changed = true;
+            return;
+        }
+
+        if (mtime == old.mtime && mtime != 0)
+        {
+            new_index[rel] = old;
+            for (auto &s : old.dirs)
+                check(join(rel, s));
+            return;
+        }
+
+        changed = true;
+        auto &d = new_index[rel];
+        d.mtime = mtime;
+        read_directory(p, [&](const String &name, bool dir)
+        {
+            if (!dir)
+            {
+                d.files.push_back(name);
+                return;
+            }
+            if (enter_dir && !enter_dir(join(rel, name)))
+                return;
+            d.dirs.push_back(name);
+        });
+        for (auto &s : d.dirs)
+        {
+            auto r = join(rel, s);
+            if (index.find(r) != index.end())
+                check(r);
+            else
+                walk(r);
+        }
+    };
+
+    if (index.empty())
+        walk(String());
+    else
+        check(String());
+
+    std::vector<WalkEntry> result;
+    for (auto &d : new_index)
+    {
+        for (auto &f : d.second.files)
+        {
+            auto rel = join(d.first, f);
+            result.push_back({ root / rel, rel });
+        }
+    }
+    std::sort(result.begin(), result.end(), [](const auto &e1, const auto &e2)
+    {
+        return e1.rel < e2.rel;
+    });
+
+    if (changed)
+    {
+        String s = index_version + "\n" + root_s + "\n";
+        for (auto &d : new_index)
+        {
+            auto mtime = d.second.mtime >= start - 1 ? 0 : d.second.mtime;
+            s += "d " + std::to_string((int64_t)mtime) + " " + d.first + "\n";
+            for (auto &f : d.second.files)
+                s += "f " + f + "\n";
+            for (auto &sd : d.second.dirs)
+                s += "s " + sd + "\n";
+        }
+        if (index_fn.has_parent_path())
+            fs::create_directories(index_fn.parent_path());
+        write_file(index_fn, s);
+    }
+
+    return result;
+}
+
+MappedFile::MappedFile(const path &p)
+{
+    auto err = [&p](const String &s)
+    {
+        return std::runtime_error("Cannot map file " + p.string() + ": " + s);
+    };
+
+#ifdef _WIN32
+    file = CreateFileW(p.wstring().c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        file = nullptr;
+        throw err("cannot open");
+    }
+    LARGE_INTEGER li;
+    if (!GetFileSizeEx(file, &li))
+    {
+        CloseHandle(file);
+        throw err("cannot get size");
+    }
+    sz = (size_t)li.QuadPart;
+    if (sz == 0)
+        return;
+    mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping)
+    {
+        CloseHandle(file);
+        throw err("cannot create mapping");
+    }
+    ptr = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!ptr)
+    {
+        CloseHandle(mapping);
+        CloseHandle(file);
+        throw err("cannot map view");
+    }
+#else
+    fd = open(p.string().c_str(), O_RDONLY);
+    if (fd == -1)
+        throw err("cannot open");
+    struct stat st;
+    if (fstat(fd, &st) == -1)
+    {
+        close(fd);
+        throw err("cannot get size");
+    }
+    sz = (size_t)st.st_size;
+    if (sz == 0)
+        return;
+    auto m = mmap(nullptr, sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (m == MAP_FAILED)
+    {
+        close(fd);
+        throw err("mmap failed");
+    }
+    ptr = (const char *)m;
+#endif
+}
+
+MappedFile::~MappedFile()
+{
+#ifdef _WIN32
+    if (ptr)
+        UnmapViewOfFile(ptr);
+    if (mapping)
+        CloseHandle(mapping);
+    if (file)
+        CloseHandle(file);
+#else
+    if (ptr)
+        munmap((void *)ptr, sz);
+    if (fd != -1)
+        close(fd);
+#endif
+}
@@ -18,13 +18,21 @@
 
 #include <primitives/filesystem.h>
 
+#include <functional>
 #include <unordered_map>
+#include <vector>
 
 #define STAMPS_DIR "stamps"
 #define STORAGE_DIR "storage"
 #define CPPAN_FILENAME "cppan.yml"
 
-using Stamps = std::unordered_map<path, time_t>;
+struct FileStamp
+{
+    time_t time = 0;
+    String hash; // hash of the last written contents
+};
+
+using Stamps = std::unordered_map<path, FileStamp>;
 using SourceGroups = std::map<String, std::set<String>>;
 
 path get_root_directory();
@@ -37,3 +45,46 @@ String get_stamp_filename(const String &prefix);
 String make_archive_name(const String &fn = String());
 
 path findRootDirectory(const path &p = fs::current_path());
+
+struct WalkEntry
+{
+    path p;
+    // relative to the walk root, with '/' separators
+    String rel;
+};
+
+// gets a relative dir path, returns false to skip the dir
+using WalkFilter = std::function<bool(const String &rel_dir)>;
+
+// recursive walk on several threads, returns regular files sorted by relative path
+// symlinks to dirs are not followed (like in recursive_directory_iterator)
+// the filter is called concurrently
+std::vector<WalkEntry> walk_directory(const path &root, const WalkFilter &enter_dir = WalkFilter(), int n_threads = 0);
+
+// same, but the tree is stored in the index file with dir mtimes
+// and only changed dirs are read on the next calls
+// the filter must be the same for the same index file
+std::vector<WalkEntry> walk_directory(const path &root, const path &index_fn, const WalkFilter &enter_dir = WalkFilter());
+
+// read only memory mapping of the whole file
+class MappedFile
+{
+public:
+    MappedFile(const path &p);
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    ~MappedFile();
+
+    const char *data() const { return ptr; }
+    size_t size() const { return sz; }
+
+private:
+    const char *ptr = nullptr;
+    size_t sz = 0;
+#ifdef _WIN32
+    void *file = nullptr;
+    void *mapping = nullptr;
+#else
+    int fd = -1;
+#endif
+};
@@ -0,0 +1,94 @@
+#include <access_table.h>
+#include <database.h>
+#include <database_detail.h>
+#include <directories.h>
+#include <hash.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch.hpp>
+
+// storage with a new service db
+struct TempStorage
+{
+    path dir;
+
+    TempStorage()
+    {
+        dir = fs::temp_directory_path() / fs::unique_path("cppan_test_%%%%%%%%");
+        directories.set_storage_dir(dir);
+        fs::create_directories(getDbDirectory());
+
+        // nothing to clean up in a new storage
+        auto &sdb = getServiceDatabase(false);
+        for (auto &a : startup_actions)
+            sdb.setActionPerformed(a);
+        sdb.setLastClientUpdateCheck();
+        getServiceDatabase();
+    }
+
+    ~TempStorage()
+    {
+        boost::system::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+};
+
+// stamp stored in the service db, nullptr when there is none
+const FileStamp *find_stored(const Stamps &stamps, const path &p)
+{
+    auto i = stamps.find(normalize_path(p));
+    if (i == stamps.end())
+        return nullptr;
+    return &i->second;
+}
+
+TEST_CASE("only changed stamps are stored", "[access_table]")
+{
+    TempStorage s;
+    auto a = directories.storage_dir_obj / "a.txt";
+    auto b = directories.storage_dir_obj / "x" / "b.txt";
+
+    {
+        AccessTable t1;
+        {
+            AccessTable t2;
+            t2.write_if_older(a, "a");
+        }
+        // stamps are written by the last table
+        REQUIRE_FALSE(find_stored(getServiceDatabase().getFileStamps(), a));
+        t1.write_if_older(b, "b");
+    }
+
+    auto stamps = getServiceDatabase().getFileStamps();
+    REQUIRE(find_stored(stamps, a));
+    REQUIRE(find_stored(stamps, a)->hash == sha256("a"));
+    REQUIRE(find_stored(stamps, a)->time == fs::last_write_time(a));
+    REQUIRE(find_stored(stamps, b));
+    REQUIRE(find_stored(stamps, b)->hash == sha256("b"));
+
+    {
+        AccessTable t;
+        // stamp written by another process meanwhile is not overwritten
+        getServiceDatabase().updateFileStamps({ { b, FileStamp{ 1, "other" } } }, {});
+        t.write_if_older(a, "a2");
+    }
+
+    stamps = getServiceDatabase().getFileStamps();
+    REQUIRE(find_stored(stamps, a)->hash == sha256("a2"));
+    REQUIRE(find_stored(stamps, b)->hash == "other");
+
+    {
+        AccessTable t;
+        t.remove(directories.storage_dir_obj / "x");
+    }
+
+    stamps = getServiceDatabase().getFileStamps();
+    REQUIRE(find_stored(stamps, a));
+    REQUIRE_FALSE(find_stored(stamps, b));
+}
+
+int main(int argc, char **argv)
+{
+    auto rc = Catch::Session().run(argc, argv);
+    return rc;
+}
@@ -0,0 +1,41 @@
+#include <checks.h>
+#include <settings.h>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch.hpp>
+
+TEST_CASE("different flags give different cache keys", "[checks]")
+{
+    auto key = [](const Settings &s)
+    {
+        ParallelCheckOptions o;
+        o.dir = "non_existent_test_run_dir";
+        o.generator = "Ninja";
+        o.settings_hash = s.get_build_settings_hash();
+        return o.getToolchainHash();
+    };
+
+    Settings s1;
+    s1.c_compiler_flags = "-O2";
+    s1.cxx_compiler_flags = "-O2";
+
+    Settings s2 = s1;
+    REQUIRE(key(s1) == key(s2));
+
+    s2.cxx_compiler_flags = "-O2 -fno-exceptions";
+    REQUIRE(key(s1) != key(s2));
+
+    s2 = s1;
+    s2.compiler_flags = "-DNDEBUG";
+    REQUIRE(key(s1) != key(s2));
+
+    s2 = s1;
+    s2.c_compiler_flags_conf[Settings::CMakeConfigurationType::Debug] = "-O0";
+    REQUIRE(key(s1) != key(s2));
+}
+
+int main(int argc, char **argv)
+{
+    auto rc = Catch::Session().run(argc, argv);
+    return rc;
+}
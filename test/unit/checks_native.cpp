@@ -0,0 +1,160 @@
+#include <checks_detail.h>
+#include <checks_native.h>
+
+#include <primitives/command.h>
+
+#include <cstddef>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch.hpp>
+
+// test run dir with the compiler detected by cmake
+struct TestRun
+{
+    path dir;
+    bool has_compiler = false;
+
+    TestRun()
+    {
+        dir = fs::temp_directory_path() / fs::unique_path("cppan_test_%%%%%%%%");
+        auto cmake_files = dir / "CMakeFiles" / "3.9.0";
+        fs::create_directories(cmake_files);
+
+        struct Compiler
+        {
+            String c;
+            String cxx;
+            String id;
+        };
+        for (auto &c : { Compiler{ "gcc", "g++", "GNU" }, Compiler{ "clang", "clang++", "Clang" } })
+        {
+            auto cc = primitives::resolve_executable(c.c);
+            auto cxx = primitives::resolve_executable(c.cxx);
+            if (cc.empty() || cxx.empty())
+                continue;
+            write_file(cmake_files / "CMakeCCompiler.cmake",
+                "set(CMAKE_C_COMPILER \"" + normalize_path(cc) + "\")\n"
+                "set(CMAKE_C_COMPILER_ID \"" + c.id + "\")\n");
+            write_file(cmake_files / "CMakeCXXCompiler.cmake",
+                "set(CMAKE_CXX_COMPILER \"" + normalize_path(cxx) + "\")\n"
+                "set(CMAKE_CXX_COMPILER_ID \"" + c.id + "\")\n");
+            has_compiler = true;
+            break;
+        }
+
+        // the second header compiles only after the first one
+        write_file(dir / "include" / "cppan_base.h", "typedef int cppan_base_t;\n");
+        write_file(dir / "include" / "cppan_needs_base.h", "cppan_base_t cppan_needs_base(void);\n");
+    }
+
+    ~TestRun()
+    {
+        boost::system::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    // missing ones make batches fail, so they are split
+    std::vector<CheckPtr> getChecks() const
+    {
+        std::vector<CheckPtr> checks;
+        CheckParameters p;
+        p.include_directories.insert(normalize_path(dir / "include"));
+        for (auto &h : { "stdio.h", "stdlib.h", "string.h", "cppan_base.h", "cppan_needs_base.h", "cppan_missing1.h", "cppan_missing2.h" })
+        {
+            checks.push_back(std::make_shared<CheckInclude>(h));
+            checks.back()->parameters = p;
+        }
+        for (auto &f : { "puts", "fopen", "cppan_missing_function", "fclose" })
+            checks.push_back(std::make_shared<CheckFunction>(f));
+        for (auto &t : { "int", "long long", "struct cppan_missing_type", "size_t" })
+            checks.push_back(std::make_shared<CheckType>(t));
+        for (auto &t : { "double", "struct cppan_missing_type" })
+            checks.push_back(std::make_shared<CheckAlignment>(t));
+        return checks;
+    }
+};
+
+// evaluates all checks together or one by one
+std::map<String, Check::Value> run(const TestRun &t, bool batch, int N)
+{
+    ParallelCheckOptions o;
+    o.dir = t.dir;
+
+    std::map<String, Check::Value> values;
+    auto checks = t.getChecks();
+    auto run = [&o, &values, N](const std::vector<CheckPtr> &v)
+    {
+        Checks cs;
+        for (auto &c : v)
+            cs.checks.insert(c);
+        CheckDurations durations;
+        NativeChecker nc(o);
+        REQUIRE(nc.isAvailable());
+        auto done = nc.run(cs, N, durations);
+        REQUIRE(cs.checks.empty());
+        REQUIRE(done.checks.size() == v.size());
+        for (auto &c : v)
+            values[c->getVariable()] = c->getValue();
+    };
+    if (batch)
+        run(checks);
+    else
+    {
+        for (auto &c : checks)
+            run({ c });
+    }
+    return values;
+}
+
+TEST_CASE("batched native checks give the same results as single ones", "[checks]")
+{
+    TestRun t;
+    if (!t.has_compiler)
+    {
+        WARN("No gcc or clang found, native checks are not tested");
+        return;
+    }
+
+    struct Alignment
+    {
+        char a;
+        double b;
+    };
+
+    std::map<String, Check::Value> expected = {
+        { "HAVE_STDIO_H", 1 },
+        { "HAVE_STDLIB_H", 1 },
+        { "HAVE_STRING_H", 1 },
+        { "HAVE_CPPAN_BASE_H", 1 },
+        // does not compile alone, so it is not found even when batched with cppan_base.h
+        { "HAVE_CPPAN_NEEDS_BASE_H", 0 },
+        { "HAVE_CPPAN_MISSING1_H", 0 },
+        { "HAVE_CPPAN_MISSING2_H", 0 },
+        { "HAVE_PUTS", 1 },
+        { "HAVE_FOPEN", 1 },
+        { "HAVE_CPPAN_MISSING_FUNCTION", 0 },
+        { "HAVE_FCLOSE", 1 },
+        // types are checked like check_type_size(), value is the size
+        { "HAVE_INT", (int)sizeof(int) },
+        { "HAVE_LONG_LONG", (int)sizeof(long long) },
+        { "HAVE_STRUCT_CPPAN_MISSING_TYPE", 0 },
+        { "HAVE_SIZE_T", (int)sizeof(size_t) },
+        { "ALIGNOF_DOUBLE", (int)offsetof(Alignment, b) },
+        { "ALIGNOF_STRUCT_CPPAN_MISSING_TYPE", 0 },
+    };
+
+    auto single = run(t, false, 1);
+    for (int n : { 1, 4 })
+    {
+        auto batched = run(t, true, n);
+        REQUIRE(batched == single);
+    }
+
+    REQUIRE(single == expected);
+}
+
+int main(int argc, char **argv)
+{
+    auto rc = Catch::Session().run(argc, argv);
+    return rc;
+}
@@ -0,0 +1,183 @@
+#include <database_detail.h>
+#include <sqlite_database.h>
+
+#include <algorithm>
+#include <map>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch.hpp>
+
+// in-memory packages db
+struct TestDb
+{
+    SqliteDatabase db;
+
+    TestDb()
+    {
+        for (auto &td : data_tables)
+            db.execute(td.query);
+    }
+
+    // package path -> selected version id, 0 when unresolved
+    std::map<String, int64_t> closure(int64_t project_version_id) const
+    {
+        std::map<String, int64_t> r;
+        auto &st = db.prepare(dependencies_closure_query);
+        st.bindAll(project_version_id);
+        db.execute(st, [&r](const SqliteStatement &st)
+        {
+            r[std::to_string(st.getInt64(0)) + " " + st.getText(2)] = st.isNull(1) ? 0 : st.getInt64(1);
+        });
+        return r;
+    }
+};
+
+TEST_CASE("dependency versions are selected in sql", "[database]")
+{
+    TestDb t;
+    t.db.execute(R"(
+        insert into Projects values (1, 'org.app', 1, 0), (2, 'org.lib', 1, 0), (3, 'org.util', 1, 0);
+        insert into ProjectVersions values
+            (10, 1, 1, 0, 0, null, 0, '2017-01-01 00:00:00', 'h'),
+            (20, 2, 1, 0, 0, null, 0, '2017-01-01 00:00:00', 'h'),
+            (21, 2, 1, 2, 0, null, 0, '2017-01-01 00:00:00', 'h'),
+            (22, 2, 1, 2, 5, null, 0, '2017-01-01 00:00:00', 'h'),
+            (23, 2, 2, 0, 1, null, 0, '2017-01-01 00:00:00', 'h'),
+            (24, 2, null, null, null, 'master', 0, '2017-01-01 00:00:00', 'h'),
+            (30, 3, 0, 1, 0, null, 0, '2017-01-01 00:00:00', 'h'),
+            (31, 3, 0, 3, 0, null, 0, '2017-01-01 00:00:00', 'h');
+        insert into ProjectVersionDependencies values
+            (22, 3, '0', 0),
+            (23, 3, '0.1', 0),
+            (24, 3, '0.1.0', 0);
+    )");
+
+    auto select = [&t](const String &version)
+    {
+        t.db.execute("delete from ProjectVersionDependencies where project_version_id = 10");
+        t.db.execute("insert into ProjectVersionDependencies values (10, 2, '" + version + "', 0)");
+        return t.closure(10);
+    };
+
+    using Closure = std::map<String, int64_t>;
+
+    // exact, the latest x.y.*, the latest x.*, the latest *, a branch
+    REQUIRE(select("1.2.0") == (Closure{ { "10 org.lib", 21 } }));
+    REQUIRE(select("1.2.5") == (Closure{ { "10 org.lib", 22 }, { "22 org.util", 31 } }));
+    REQUIRE(select("1.2") == (Closure{ { "10 org.lib", 22 }, { "22 org.util", 31 } }));
+    REQUIRE(select("1") == (Closure{ { "10 org.lib", 22 }, { "22 org.util", 31 } }));
+    REQUIRE(select("2.0") == (Closure{ { "10 org.lib", 23 }, { "23 org.util", 30 } }));
+    REQUIRE(select("*") == (Closure{ { "10 org.lib", 23 }, { "23 org.util", 30 } }));
+    REQUIRE(select("master") == (Closure{ { "10 org.lib", 24 }, { "24 org.util", 30 } }));
+
+    // unresolved dependencies have no version
+    REQUIRE(select("1.1") == (Closure{ { "10 org.lib", 0 } }));
+    REQUIRE(select("1.2.4") == (Closure{ { "10 org.lib", 0 } }));
+    REQUIRE(select("3") == (Closure{ { "10 org.lib", 0 } }));
+    REQUIRE(select("develop") == (Closure{ { "10 org.lib", 0 } }));
+
+    // cycles are visited once
+    t.db.execute("insert into ProjectVersionDependencies values (31, 2, '1.2', 0)");
+    REQUIRE(select("1") == (Closure{ { "10 org.lib", 22 }, { "22 org.util", 31 }, { "31 org.lib", 22 } }));
+}
+
+// all rows of a table, sorted
+String dump(const SqliteDatabase &db, const String &table)
+{
+    Strings rows;
+    db.execute("select * from " + table, [&rows](SQLITE_CALLBACK_ARGS)
+    {
+        String r;
+        for (int i = 0; i < ncols; i++)
+            r += String(cols[i] ? cols[i] : "NULL") + ";";
+        rows.push_back(r);
+        return 0;
+    });
+    std::sort(rows.begin(), rows.end());
+    String s;
+    for (auto &r : rows)
+        s += r + "\n";
+    return s;
+}
+
+TEST_CASE("row deltas give the same tables as a full load", "[database]")
+{
+    const std::map<String, std::pair<String, String>> csv = {
+        { "Projects", {
+            "1;org.app;1;0\n"
+            "2;org.lib;1;0\n"
+            "3;org.old;1;0\n",
+            // changed, kept, added, removed
+            "1;org.app;1;4\n"
+            "2;org.lib;1;0\n"
+            "4;org.new;2;0\n"
+        } },
+        { "ProjectVersions", {
+            "10;1;1;0;0;;0;2017-01-01 00:00:00;h10\n"
+            "20;2;;;;master;0;2017-01-01 00:00:00;h20\n"
+            "30;3;0;1;0;;0;2017-01-01 00:00:00;h30\n",
+            // null fields are kept
+            "10;1;1;0;0;;0;2017-01-01 00:00:00;h10\n"
+            "20;2;;;;master;0;2017-02-01 00:00:00;h21\n"
+            "40;4;0;0;1;;0;2017-02-01 00:00:00;h40\n"
+        } },
+        { "ProjectVersionDependencies", {
+            // composite key
+            "10;2;master;0\n"
+            "10;3;0.1;0\n",
+            "10;2;master;1\n"
+            "10;4;0;0\n"
+        } },
+    };
+
+    auto apply = [&csv](const SqliteDatabase &db, bool old_to_new, size_t *n_deleted = nullptr, size_t *n_inserted = nullptr)
+    {
+        db.execute("BEGIN;");
+        for (auto &td : data_tables)
+        {
+            auto &data = csv.find(td.name)->second;
+            TableDelta d;
+            REQUIRE(get_table_delta(db, td, old_to_new ? data.first : "", old_to_new ? data.second : data.first, d));
+            apply_table_delta(db, d);
+            if (n_deleted)
+                *n_deleted += d.n_deleted;
+            if (n_inserted)
+                *n_inserted += d.n_inserted;
+        }
+        db.execute("COMMIT;");
+    };
+
+    TestDb updated;
+    apply(updated.db, false);
+    size_t n_deleted = 0, n_inserted = 0;
+    apply(updated.db, true, &n_deleted, &n_inserted);
+    REQUIRE(n_deleted == 6);
+    REQUIRE(n_inserted == 6);
+
+    TestDb loaded;
+    for (auto &td : data_tables)
+    {
+        TableDelta d;
+        REQUIRE(get_table_delta(loaded.db, td, "", csv.find(td.name)->second.second, d));
+        apply_table_delta(loaded.db, d);
+    }
+
+    for (auto &td : data_tables)
+    {
+        INFO(td.name);
+        REQUIRE(dump(updated.db, td.name) == dump(loaded.db, td.name));
+    }
+    REQUIRE(dump(updated.db, "Projects") == "1;org.app;1;4;\n2;org.lib;1;0;\n4;org.new;2;0;\n");
+
+    // rows cannot be deleted without a key
+    TableDescriptor td{ "NoKey", "create table NoKey (a integer, b text);" };
+    updated.db.execute(td.query);
+    TableDelta d;
+    REQUIRE_FALSE(get_table_delta(updated.db, td, "1;a\n", "1;b\n", d));
+}
+
+int main(int argc, char **argv)
+{
+    auto rc = Catch::Session().run(argc, argv);
+    return rc;
+}
@@ -0,0 +1,157 @@
+#include <file_matcher.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <regex>
+#include <set>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch.hpp>
+
+// project root with a char escaped by the old code
+const String root = "/tmp/c++/project";
+
+const Strings files = {
+    "a",
+    "b",
+    "a.h",
+    "a.b",
+    "axb",
+    "x.h",
+    "main.cpp",
+    "src.cpp",
+    "include.h",
+    "a/c",
+    "a/b/c",
+    "a/bbb/c",
+    "a/x/c",
+    "a/b/x/c",
+    "src/main.cpp",
+    "src/mainxcpp",
+    "src/a.cpp",
+    "src/x/y.h",
+    "src/x/y.cpp",
+    "srcx/main.cpp",
+    "include/x/a.h",
+    "include/y/b/c.h",
+    "include/z/a.h",
+};
+
+// findSources() before FileMatcher: a regex over the absolute path
+bool old_match(const String &pattern, const String &rel)
+{
+    std::regex r(boost::replace_all_copy(root, "+", "\\+") + "/" + pattern);
+    return std::regex_match(root + "/" + rel, r);
+}
+
+Strings get_dirs()
+{
+    std::set<String> dirs;
+    for (auto &f : files)
+    {
+        for (auto p = f.find('/'); p != String::npos; p = f.find('/', p + 1))
+            dirs.insert(f.substr(0, p));
+    }
+    return Strings(dirs.begin(), dirs.end());
+}
+
+void compare(const String &pattern)
+{
+    FileMatcher m({ pattern });
+    for (auto &f : files)
+    {
+        INFO(pattern << " " << f);
+        REQUIRE(m.match(f) == old_match(pattern, f));
+    }
+
+    // dirs with matches must be walked
+    for (auto &d : get_dirs())
+    {
+        bool has_matches = false;
+        for (auto &f : files)
+            has_matches |= boost::starts_with(f, d + "/") && old_match(pattern, f);
+        if (!has_matches)
+            continue;
+        INFO(pattern << " " << d);
+        REQUIRE(m.canEnter(d));
+    }
+}
+
+TEST_CASE("same matches as regex", "[file_matcher]")
+{
+    compare("src/.*");
+    compare(".*\\.h");
+    compare("[^/]*\\.cpp");
+    compare("a/b*/c");
+    compare("src/main.cpp");
+    compare("src/main\\.cpp");
+    compare("include/(x|y)/.*");
+    compare("a\\.b");
+    compare("include/x/a\\.h");
+}
+
+TEST_CASE("several patterns", "[file_matcher]")
+{
+    std::set<String> patterns = { "src/.*", "[^/]*\\.h", "include/(x|y)/.*", "a/b*/c" };
+    FileMatcher m(patterns);
+    for (auto &f : files)
+    {
+        bool old = false;
+        for (auto &p : patterns)
+            old |= old_match(p, f);
+        INFO(f);
+        REQUIRE(m.match(f) == old);
+    }
+}
+
+TEST_CASE("skipped dirs", "[file_matcher]")
+{
+    FileMatcher src({ "src/.*" });
+    REQUIRE(src.canEnter("src"));
+    REQUIRE(src.canEnter("src/x"));
+    REQUIRE_FALSE(src.canEnter("srcx"));
+    REQUIRE_FALSE(src.canEnter("include"));
+
+    FileMatcher cpp({ "[^/]*\\.cpp" });
+    REQUIRE_FALSE(cpp.canEnter("src"));
+    REQUIRE_FALSE(cpp.canEnter("a"));
+
+    FileMatcher h({ ".*\\.h" });
+    REQUIRE(h.canEnter("src"));
+    REQUIRE(h.canEnter("include/y/b"));
+
+    FileMatcher inc({ "include/(x|y)/.*" });
+    REQUIRE(inc.canEnter("include"));
+    REQUIRE_FALSE(inc.canEnter("src"));
+
+    // unescaped '.' matches '/' too
+    FileMatcher dot({ "src/main.cpp" });
+    REQUIRE(dot.match("src/main/cpp"));
+    REQUIRE(dot.canEnter("src/main"));
+
+    FileMatcher lit({ "src/main\\.cpp" });
+    REQUIRE(lit.canEnter("src"));
+    REQUIRE_FALSE(lit.canEnter("src/x"));
+}
+
+TEST_CASE("top level alternation", "[file_matcher]")
+{
+    // each branch is relative to the root now,
+    // old regex was (root/a)|b and never matched 'b'
+    FileMatcher m({ "a|b" });
+    REQUIRE(m.match("a"));
+    REQUIRE(m.match("b"));
+    REQUIRE_FALSE(m.match("a/c"));
+    REQUIRE_FALSE(m.match("axb"));
+    REQUIRE(old_match("a|b", "a"));
+    REQUIRE_FALSE(old_match("a|b", "b"));
+
+    // branches cannot match in subdirs
+    REQUIRE_FALSE(m.canEnter("src"));
+}
+
+int main(int argc, char **argv)
+{
+    auto rc = Catch::Session().run(argc, argv);
+    return rc;
+}
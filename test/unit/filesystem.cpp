@@ -0,0 +1,302 @@
+#include <filesystem.h>
+
+#include <boost/algorithm/string.hpp>
+
+#include <algorithm>
+#include <ctime>
+#include <mutex>
+#include <thread>
+
+#define CATCH_CONFIG_RUNNER
+#include <catch.hpp>
+
+struct TempDir
+{
+    path dir;
+
+    TempDir()
+    {
+        dir = fs::temp_directory_path() / fs::unique_path("cppan_test_%%%%%%%%");
+        fs::create_directories(dir);
+    }
+
+    ~TempDir()
+    {
+        boost::system::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+
+    void add_file(const String &rel) const
+    {
+        auto p = dir / rel;
+        fs::create_directories(p.parent_path());
+        write_file(p, rel);
+    }
+};
+
+// regular files as seen by recursive_directory_iterator
+Strings iterate(const path &root, const WalkFilter &enter_dir = WalkFilter())
+{
+    Strings files;
+    auto root_s = normalize_path(root) + "/";
+    for (auto i = fs::recursive_directory_iterator(root); i != fs::recursive_directory_iterator(); ++i)
+    {
+        auto rel = normalize_path(i->path()).substr(root_s.size());
+        if (fs::is_directory(i->symlink_status()))
+        {
+            if (enter_dir && !enter_dir(rel))
+                i.no_push();
+            continue;
+        }
+        if (fs::is_regular_file(i->path()))
+            files.push_back(rel);
+    }
+    std::sort(files.begin(), files.end());
+    return files;
+}
+
+Strings get_rels(const std::vector<WalkEntry> &entries)
+{
+    Strings files;
+    for (auto &e : entries)
+        files.push_back(e.rel);
+    return files;
+}
+
+TEST_CASE("walk is the same as recursive_directory_iterator", "[walk]")
+{
+    TempDir t;
+    t.add_file("a.txt");
+    t.add_file("x/b.txt");
+    t.add_file("x/y/c.txt");
+    t.add_file("x/y/z/d.txt");
+    t.add_file("x/skip/e.txt");
+    t.add_file("x/skip/f/g.txt");
+    t.add_file("w/h.txt");
+    fs::create_directories(t.dir / "empty");
+
+    boost::system::error_code ec;
+    fs::create_symlink(t.dir / "x" / "b.txt", t.dir / "file_link", ec);
+    bool file_link = !ec;
+    fs::create_directory_symlink(t.dir / "x", t.dir / "dir_link", ec);
+    bool dir_link = !ec;
+
+    auto expected = iterate(t.dir);
+    REQUIRE(expected.size() == 7 + file_link);
+
+    for (int n : { 1, 4 })
+    {
+        auto files = walk_directory(t.dir, WalkFilter(), n);
+        REQUIRE(get_rels(files) == expected);
+        for (auto &f : files)
+            REQUIRE(f.p == t.dir / f.rel);
+    }
+
+    // a file symlink is a file
+    auto files = get_rels(walk_directory(t.dir));
+    if (file_link)
+        REQUIRE(std::find(files.begin(), files.end(), "file_link") != files.end());
+
+    // a dir symlink is not followed
+    if (dir_link)
+    {
+        for (auto &f : files)
+            REQUIRE_FALSE(boost::starts_with(f, "dir_link/"));
+    }
+}
+
+TEST_CASE("filter prunes subtrees", "[walk]")
+{
+    TempDir t;
+    t.add_file("a.txt");
+    t.add_file("x/b.txt");
+    t.add_file("x/skip/e.txt");
+    t.add_file("x/skip/f/g.txt");
+    t.add_file("skip/h.txt");
+
+    std::mutex m;
+    Strings entered;
+    auto filter = [&m, &entered](const String &rel)
+    {
+        std::unique_lock<std::mutex> lk(m);
+        entered.push_back(rel);
+        return rel != "x/skip";
+    };
+
+    auto expected = iterate(t.dir, [](const String &rel) { return rel != "x/skip"; });
+    REQUIRE(expected == Strings{ "a.txt", "skip/h.txt", "x/b.txt" });
+
+    for (int n : { 1, 4 })
+    {
+        entered.clear();
+        REQUIRE(get_rels(walk_directory(t.dir, filter, n)) == expected);
+
+        // pruned dirs are not read
+        std::sort(entered.begin(), entered.end());
+        REQUIRE(entered == Strings{ "skip", "x", "x/skip" });
+    }
+}
+
+// dirs modified in the last seconds are always read again, make them old
+void age(const path &root)
+{
+    auto t = time(nullptr) - 100;
+    fs::last_write_time(root, t);
+    for (auto &e : boost::make_iterator_range(fs::recursive_directory_iterator(root), {}))
+    {
+        if (fs::is_directory(e.symlink_status()))
+            fs::last_write_time(e, t);
+    }
+}
+
+TEST_CASE("walk with an index", "[walk]")
+{
+    TempDir t;
+    auto root = t.dir / "root";
+    auto index = t.dir / "index";
+    auto check = [&root, &index]()
+    {
+        REQUIRE(get_rels(walk_directory(root, index)) == get_rels(walk_directory(root)));
+    };
+
+    t.add_file("root/a.txt");
+    t.add_file("root/x/b.txt");
+    t.add_file("root/x/y/c.txt");
+    t.add_file("root/w/d.txt");
+    age(root);
+    check();
+
+    SECTION("unchanged tree")
+    {
+        fs::last_write_time(index, time(nullptr) - 100);
+        auto mtime = fs::last_write_time(index);
+        check();
+        REQUIRE(fs::last_write_time(index) == mtime);
+    }
+
+    SECTION("dir added")
+    {
+        t.add_file("root/x/new/e.txt");
+        t.add_file("root/x/new/z/f.txt");
+        check();
+    }
+
+    SECTION("dir removed")
+    {
+        fs::remove_all(root / "x" / "y");
+        check();
+        fs::remove_all(root / "w");
+        check();
+    }
+
+    SECTION("file added in an unchanged parent")
+    {
+        auto mtime = fs::last_write_time(root / "x");
+        t.add_file("root/x/y/g.txt");
+        REQUIRE(fs::last_write_time(root / "x") == mtime);
+        check();
+    }
+
+    SECTION("change in the same second")
+    {
+        // dir has the same mtime after the second change
+        t.add_file("root/x/h.txt");
+        auto mtime = fs::last_write_time(root / "x");
+        check();
+        t.add_file("root/x/i.txt");
+        fs::last_write_time(root / "x", mtime);
+        check();
+    }
+
+    SECTION("version or root mismatch")
+    {
+        // the same index for another root
+        auto root2 = t.dir / "root2";
+        t.add_file("root2/j.txt");
+        t.add_file("root2/x/k.txt");
+        age(root2);
+        REQUIRE(get_rels(walk_directory(root2, index)) == (Strings{ "j.txt", "x/k.txt" }));
+        check();
+
+        // unknown version
+        auto s = read_file(index);
+        write_file(index, "0" + s.substr(s.find('\n')));
+        t.add_file("root/x/l.txt");
+        age(root);
+        check();
+    }
+}
+
+TEST_CASE("errors are propagated", "[walk]")
+{
+    TempDir t;
+    REQUIRE_THROWS(walk_directory(t.dir / "missing"));
+
+    t.add_file("a.txt");
+    t.add_file("x/b.txt");
+    t.add_file("x/closed/c.txt");
+    fs::permissions(t.dir / "x" / "closed", fs::no_perms);
+
+    // privileged users still can read it
+    boost::system::error_code ec;
+    fs::directory_iterator i(t.dir / "x" / "closed", ec);
+    if (ec)
+    {
+        REQUIRE_THROWS(iterate(t.dir));
+        REQUIRE_THROWS(walk_directory(t.dir, WalkFilter(), 1));
+        REQUIRE_THROWS(walk_directory(t.dir, WalkFilter(), 4));
+
+        // skipped dir is not read
+        REQUIRE(get_rels(walk_directory(t.dir, [](const String &rel) { return rel != "x/closed"; })) ==
+                (Strings{ "a.txt", "x/b.txt" }));
+    }
+
+    fs::permissions(t.dir / "x" / "closed", fs::owner_all);
+}
+
+TEST_CASE("walks from several threads", "[walk]")
+{
+    TempDir t;
+    for (int i = 0; i < 8; i++)
+    {
+        for (int j = 0; j < 8; j++)
+            t.add_file(std::to_string(i) + "/" + std::to_string(j) + "/a.txt");
+    }
+    auto expected = iterate(t.dir);
+    REQUIRE(expected.size() == 64);
+
+    // threads of all walks are bounded, so every walk must finish with any number of them
+    std::vector<Strings> results(8);
+    std::vector<std::thread> threads;
+    for (auto &r : results)
+    {
+        threads.emplace_back([&t, &r]
+        {
+            r = get_rels(walk_directory(t.dir, WalkFilter(), 4));
+        });
+    }
+    for (auto &th : threads)
+        th.join();
+    for (auto &r : results)
+        REQUIRE(r == expected);
+
+    // nested walks
+    std::mutex m;
+    size_t n = 0;
+    auto files = walk_directory(t.dir, [&t, &m, &n](const String &rel)
+    {
+        auto sub = walk_directory(t.dir / rel, WalkFilter(), 4);
+        std::unique_lock<std::mutex> lk(m);
+        n += sub.size();
+        return true;
+    }, 4);
+    REQUIRE(get_rels(files) == expected);
+    // 8 top dirs with 8 files, 64 dirs with 1 file
+    REQUIRE(n == 128);
+}
+
+int main(int argc, char **argv)
+{
+    auto rc = Catch::Session().run(argc, argv);
+    return rc;
+}
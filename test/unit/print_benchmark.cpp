@@ -0,0 +1,103 @@
+#include <access_table.h>
+#include <database.h>
+#include <database_detail.h>
+#include <directories.h>
+
+#include <primitives/executor.h>
+
+#include <chrono>
+#include <iostream>
+
+// prints N synthetic packages like PackageStore::process() does:
+// every package writes its generated files through the access table
+// usage: print_benchmark [packages [files per package]]
+
+// storage with a new service db
+struct TempStorage
+{
+    path dir;
+
+    TempStorage()
+    {
+        dir = fs::temp_directory_path() / fs::unique_path("cppan_bench_%%%%%%%%");
+        directories.set_storage_dir(dir);
+        fs::create_directories(getDbDirectory());
+
+        // nothing to clean up in a new storage
+        auto &sdb = getServiceDatabase(false);
+        for (auto &a : startup_actions)
+            sdb.setActionPerformed(a);
+        sdb.setLastClientUpdateCheck();
+        getServiceDatabase();
+    }
+
+    ~TempStorage()
+    {
+        boost::system::error_code ec;
+        fs::remove_all(dir, ec);
+    }
+};
+
+// generated files are of the size of usual CMakeLists.txt
+String generate(int package, int file, int version)
+{
+    String s;
+    for (int i = 0; i < 200; i++)
+    {
+        s += "set(VAR_" + std::to_string(package) + "_" + std::to_string(file) + "_" + std::to_string(i) +
+            " \"" + std::to_string(version) + "\")\n";
+    }
+    return s;
+}
+
+double print(const path &dir, int n_threads, int n_packages, int n_files, int version)
+{
+    auto start = std::chrono::steady_clock::now();
+    {
+        // main table, stamps are stored when it is destroyed
+        AccessTable access_table;
+        Executor e(n_threads, "Printer thread");
+        e.throw_exceptions = true;
+        for (int p = 0; p < n_packages; p++)
+        {
+            e.push([&dir, p, n_files, version]
+            {
+                AccessTable at;
+                for (int f = 0; f < n_files; f++)
+                    at.write_if_older(dir / std::to_string(p) / ("file" + std::to_string(f) + ".cmake"), generate(p, f, version));
+            });
+        }
+        e.wait();
+    }
+    std::chrono::duration<double> t = std::chrono::steady_clock::now() - start;
+    return t.count();
+}
+
+int main(int argc, char **argv)
+{
+    int n_packages = argc > 1 ? std::stoi(argv[1]) : 500;
+    int n_files = argc > 2 ? std::stoi(argv[2]) : 10;
+
+    TempStorage s;
+    std::cout << n_packages << " packages, " << n_files << " files each\n";
+    for (int n_threads : { 1, (int)get_max_threads(8) })
+    {
+        auto dir = directories.storage_dir_obj / std::to_string(n_threads);
+        {
+            // every run starts without stamps
+            AccessTable at;
+            at.clear();
+        }
+
+        // new files, same files, changed files
+        auto t_new = print(dir, n_threads, n_packages, n_files, 0);
+        auto t_same = print(dir, n_threads, n_packages, n_files, 0);
+        auto t_changed = print(dir, n_threads, n_packages, n_files, 1);
+
+        std::cout << n_threads << " threads: "
+            << "new " << t_new << " s, "
+            << "unchanged " << t_same << " s, "
+            << "changed " << t_changed << " s\n";
+    }
+    return 0;
+}